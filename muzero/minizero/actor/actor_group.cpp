@@ -3,6 +3,7 @@
 #include "create_actor.h"
 #include "create_network.h"
 #include "random.h"
+#include "time_system.h"
 #include <algorithm>
 #include <iostream>
 #include <memory>
@@ -15,10 +16,34 @@ namespace minizero::actor {
 using namespace network;
 using namespace utils;
 
-int ThreadSharedData::getAvailableActorIndex()
+void PhaseTiming::reset()
 {
-    std::lock_guard lock(mutex_);
-    return (actor_index_ < static_cast<int>(actors_.size()) ? actor_index_++ : actors_.size());
+    num_rounds_ = round_time_ = cpu_job_time_ = gpu_job_time_ = 0;
+}
+
+std::string PhaseTiming::toString() const
+{
+    // the utilizations sum to at most 100% when the phases alternate, and exceed it when they overlap
+    const double round_time = std::max(static_cast<uint64_t>(1), round_time_.load());
+    std::ostringstream oss;
+    oss << "phase timing: rounds: " << num_rounds_
+        << ", round: " << round_time / std::max(static_cast<uint64_t>(1), num_rounds_.load()) / 1000 << " ms"
+        << ", cpu utilization: " << 100 * cpu_job_time_ / (round_time * num_cpu_threads_) << "%"
+        << ", inference utilization: " << 100 * gpu_job_time_ / (round_time * num_gpu_threads_) << "%";
+    return oss.str();
+}
+
+int ThreadSharedData::getCohortBeginIndex(int cohort) const
+{
+    return config::zero_num_parallel_games * cohort / num_cohorts_;
+}
+
+int ThreadSharedData::getNetworkIndex(int actor_id) const
+{
+    // each cohort owns its networks, so that the batches of different cohorts never mix
+    int cohort = 0;
+    while (cohort + 1 < num_cohorts_ && actor_id >= getCohortBeginIndex(cohort + 1)) { ++cohort; }
+    return cohort * getNumNetworksPerCohort() + actor_id % getNumNetworksPerCohort();
 }
 
 void ThreadSharedData::outputGame(const std::shared_ptr<BaseActor>& actor)
@@ -68,46 +93,71 @@ void SlaveThread::initialize()
 
 void SlaveThread::runJob()
 {
-    if (getSharedData()->do_cpu_job_) {
-        while (doCPUJob()) {}
+    PhaseTiming& phase_timing = getSharedData()->phase_timing_;
+    boost::posix_time::ptime start_time = TimeSystem::getLocalTime();
+    if (getSharedData()->num_cohorts_ > 1) {
+        // pipelined: the first threads evaluate the batches of one cohort, then join the tree search of another cohort
+        if (doGPUJob()) {
+            boost::posix_time::ptime gpu_finish_time = TimeSystem::getLocalTime();
+            phase_timing.gpu_job_time_ += (gpu_finish_time - start_time).total_microseconds();
+            start_time = gpu_finish_time;
+        }
+        doCPUJobs();
+        phase_timing.cpu_job_time_ += (TimeSystem::getLocalTime() - start_time).total_microseconds();
+    } else if (getSharedData()->do_cpu_job_) {
+        doCPUJobs();
+        phase_timing.cpu_job_time_ += (TimeSystem::getLocalTime() - start_time).total_microseconds();
     } else {
-        doGPUJob();
+        if (doGPUJob()) { phase_timing.gpu_job_time_ += (TimeSystem::getLocalTime() - start_time).total_microseconds(); }
     }
 }
 
-bool SlaveThread::doCPUJob()
+void SlaveThread::doCPUJobs()
 {
-    size_t actor_id = getSharedData()->getAvailableActorIndex();
-    if (actor_id >= getSharedData()->actors_.size()) { return false; }
+    int begin, end;
+    while (getSharedData()->actor_range_.next(id_, begin, end)) {
+        for (int actor_id = begin; actor_id < end; ++actor_id) { doCPUJob(actor_id); }
+    }
+}
 
+void SlaveThread::doCPUJob(int actor_id)
+{
     std::shared_ptr<BaseActor>& actor = getSharedData()->actors_[actor_id];
-    int network_id = actor_id % getSharedData()->networks_.size();
+    int network_id = getSharedData()->getNetworkIndex(actor_id);
     int network_output_id = actor->getNNEvaluationBatchIndex();
     if (network_output_id >= 0) {
         assert(network_output_id < static_cast<int>(getSharedData()->network_outputs_[network_id].size()));
         actor->afterNNEvaluation(getSharedData()->network_outputs_[network_id][network_output_id]);
-        if (actor->isSearchDone()) { handleSearchDone(actor_id); }
     }
+    // the search can also finish without waiting for the network, e.g., when all leaves are found in the transposition table
+    if (actor->isSearchDone()) { handleSearchDone(actor_id); }
     actor->beforeNNEvaluation();
-    return true;
 }
 
-void SlaveThread::doGPUJob()
+bool SlaveThread::doGPUJob()
 {
-    if (id_ >= static_cast<int>(getSharedData()->networks_.size())) { return; }
+    const int num_networks = getSharedData()->getNumNetworksPerCohort();
+    if (getSharedData()->gpu_cohort_ < 0 || id_ >= num_networks) { return false; }
 
-    std::shared_ptr<Network>& network = getSharedData()->networks_[id_];
+    const int network_id = getSharedData()->gpu_cohort_ * num_networks + id_;
+    std::shared_ptr<Network>& network = getSharedData()->networks_[network_id];
     if (network->getNetworkTypeName() == "alphazero") {
         std::shared_ptr<AlphaZeroNetwork> az_network = std::static_pointer_cast<AlphaZeroNetwork>(network);
-        if (az_network->getBatchSize() > 0) { getSharedData()->network_outputs_[id_] = az_network->forward(); }
+        if (az_network->getBatchSize() > 0) {
+            getSharedData()->network_outputs_[network_id] = az_network->forward();
+            return true;
+        }
     } else if (network->getNetworkTypeName() == "muzero" || network->getNetworkTypeName() == "muzero_atari") {
         std::shared_ptr<MuZeroNetwork> muzero_network = std::static_pointer_cast<MuZeroNetwork>(network);
         if (muzero_network->getInitialInputBatchSize() > 0) {
-            getSharedData()->network_outputs_[id_] = std::static_pointer_cast<MuZeroNetwork>(network)->initialInference();
+            getSharedData()->network_outputs_[network_id] = std::static_pointer_cast<MuZeroNetwork>(network)->initialInference();
+            return true;
         } else if (muzero_network->getRecurrentInputBatchSize() > 0) {
-            getSharedData()->network_outputs_[id_] = std::static_pointer_cast<MuZeroNetwork>(network)->recurrentInference();
+            getSharedData()->network_outputs_[network_id] = std::static_pointer_cast<MuZeroNetwork>(network)->recurrentInference();
+            return true;
         }
     }
+    return false;
 }
 
 void SlaveThread::handleSearchDone(int actor_id)
@@ -118,7 +168,11 @@ void SlaveThread::handleSearchDone(int actor_id)
     if (!actor->isResign()) { actor->act(actor->getSearchAction()); }
     bool is_endgame = (actor->isResign() || actor->isEnvTerminal());
     bool display_game = (actor_id == 0 && (config::actor_num_simulation >= 50 || (config::actor_num_simulation < 50 && is_endgame)));
-    if (display_game) { std::cerr << actor->getEnvironment().toString() << actor->getSearchInfo() << std::endl; }
+    if (display_game) {
+        std::cerr << actor->getEnvironment().toString() << actor->getSearchInfo() << std::endl;
+        if (getSharedData()->nn_evaluation_cache_) { std::cerr << getSharedData()->nn_evaluation_cache_->toString() << std::endl; }
+        std::cerr << getSharedData()->phase_timing_.toString() << std::endl;
+    }
     if (is_endgame) {
         getSharedData()->outputGame(actor);
         actor->reset();
@@ -137,21 +191,56 @@ void ActorGroup::run()
         handleCommand();
 
         if (!running_) { continue; }
-        getSharedData()->actor_index_ = 0;
-        for (auto& t : slave_threads_) { t->start(); }
-        for (auto& t : slave_threads_) { t->finish(); }
-        getSharedData()->do_cpu_job_ = !getSharedData()->do_cpu_job_;
+        runRound();
+    }
+}
+
+void ActorGroup::runRound()
+{
+    std::shared_ptr<ThreadSharedData> shared_data = getSharedData();
+    if (shared_data->num_cohorts_ > 1) {
+        // one cohort searches while the previous one waits for the evaluation of the batches it has just prepared
+        shared_data->cpu_cohort_ = pipeline_round_ % shared_data->num_cohorts_;
+        shared_data->gpu_cohort_ = (pipeline_round_ + shared_data->num_cohorts_ - 1) % shared_data->num_cohorts_;
+        shared_data->actor_range_.assign(shared_data->getCohortBeginIndex(shared_data->cpu_cohort_), shared_data->getCohortBeginIndex(shared_data->cpu_cohort_ + 1));
+        ++pipeline_round_;
+    } else {
+        shared_data->actor_range_.assign(0, shared_data->actors_.size());
     }
+
+    boost::posix_time::ptime start_time = TimeSystem::getLocalTime();
+    runSlaveThreads();
+    shared_data->phase_timing_.round_time_ += (TimeSystem::getLocalTime() - start_time).total_microseconds();
+    ++shared_data->phase_timing_.num_rounds_;
+    if (shared_data->num_cohorts_ == 1) { shared_data->do_cpu_job_ = !shared_data->do_cpu_job_; }
+}
+
+void ActorGroup::flushPipeline()
+{
+    // evaluate the batches prepared in the last round, so that no network holds a pending batch while handling commands
+    std::shared_ptr<ThreadSharedData> shared_data = getSharedData();
+    if (shared_data->num_cohorts_ == 1 || pipeline_round_ == 0) { return; }
+
+    shared_data->cpu_cohort_ = -1;
+    shared_data->gpu_cohort_ = (pipeline_round_ - 1) % shared_data->num_cohorts_;
+    shared_data->actor_range_.assign(0, 0);
+    runSlaveThreads();
 }
 
 void ActorGroup::initialize()
 {
     int num_threads = std::max(static_cast<int>(torch::cuda::device_count()), config::zero_num_threads);
     createSlaveThreads(num_threads);
+    getSharedData()->actor_range_.reset(num_threads);
+    getSharedData()->num_cohorts_ = std::max(1, std::min(config::zero_num_pipeline_cohorts, config::zero_num_parallel_games));
+    getSharedData()->cpu_cohort_ = getSharedData()->gpu_cohort_ = 0;
     createNeuralNetworks();
     createActors();
     running_ = false;
+    pipeline_round_ = 0;
     getSharedData()->do_cpu_job_ = true;
+    getSharedData()->phase_timing_.num_cpu_threads_ = num_threads;
+    getSharedData()->phase_timing_.num_gpu_threads_ = getSharedData()->getNumNetworksPerCohort();
 
     // create one thread to handle I/O
     commands_.clear();
@@ -164,12 +253,22 @@ void ActorGroup::initialize()
 
 void ActorGroup::createNeuralNetworks()
 {
+    // each cohort has its own network on every GPU, which keeps the batch being filled apart from the batch being evaluated
     int num_networks = std::min(static_cast<int>(torch::cuda::device_count()), config::zero_num_parallel_games);
     assert(num_networks > 0);
-    getSharedData()->networks_.resize(num_networks);
-    getSharedData()->network_outputs_.resize(num_networks);
-    for (int gpu_id = 0; gpu_id < num_networks; ++gpu_id) {
-        getSharedData()->networks_[gpu_id] = createNetwork(config::nn_file_name, gpu_id);
+    const int num_cohorts = getSharedData()->num_cohorts_;
+    getSharedData()->networks_.resize(num_cohorts * num_networks);
+    getSharedData()->network_outputs_.resize(num_cohorts * num_networks);
+    for (int cohort = 0; cohort < num_cohorts; ++cohort) {
+        for (int gpu_id = 0; gpu_id < num_networks; ++gpu_id) {
+            getSharedData()->networks_[cohort * num_networks + gpu_id] = createNetwork(config::nn_file_name, gpu_id);
+        }
+    }
+
+    // all alphazero networks share one evaluation cache, so that positions queued by any actor are evaluated only once
+    if (config::nn_evaluation_cache_size > 0 && getSharedData()->networks_[0]->getNetworkTypeName() == "alphazero") {
+        getSharedData()->nn_evaluation_cache_ = std::make_shared<NNEvaluationCache>(config::nn_evaluation_cache_size);
+        for (auto& network : getSharedData()->networks_) { std::static_pointer_cast<AlphaZeroNetwork>(network)->setEvaluationCache(getSharedData()->nn_evaluation_cache_); }
     }
 }
 
@@ -178,8 +277,9 @@ void ActorGroup::createActors()
     assert(getSharedData()->networks_.size() > 0);
     std::shared_ptr<Network>& network = getSharedData()->networks_[0];
     uint64_t tree_node_size = static_cast<uint64_t>(config::actor_num_simulation + 1) * network->getActionSize();
+    getSharedData()->transposition_table_ = createTranspositionTable(network);
     for (int i = 0; i < config::zero_num_parallel_games; ++i) {
-        getSharedData()->actors_.emplace_back(createActor(tree_node_size, getSharedData()->networks_[i % getSharedData()->networks_.size()]));
+        getSharedData()->actors_.emplace_back(createActor(tree_node_size, getSharedData()->networks_[getSharedData()->getNetworkIndex(i)], getSharedData()->transposition_table_));
     }
 }
 
@@ -196,7 +296,12 @@ void ActorGroup::handleIO()
 
 void ActorGroup::handleCommand()
 {
-    if (commands_.empty() || !getSharedData()->do_cpu_job_) { return; }
+    if (commands_.empty()) { return; }
+    if (getSharedData()->num_cohorts_ > 1) {
+        flushPipeline();
+    } else if (!getSharedData()->do_cpu_job_) {
+        return;
+    }
 
     std::lock_guard lock(getSharedData()->mutex_);
     while (!commands_.empty()) {
@@ -227,6 +332,8 @@ void ActorGroup::handleCommand(const std::string& command_prefix, const std::str
         assert(args.size() == 2);
         config::nn_file_name = args[1];
         for (auto& network : getSharedData()->networks_) { network->loadModel(config::nn_file_name, network->getGPUID()); }
+        getSharedData()->phase_timing_.reset();
+        if (getSharedData()->transposition_table_) { getSharedData()->transposition_table_->clear(); }
     } else if (command_prefix == "update_config") {
         std::cerr << "[command] " << command << std::endl;
         assert(command.find(" ") != std::string::npos);
@@ -2,7 +2,11 @@
 
 #include "base_actor.h"
 #include "network.h"
+#include "nn_evaluation_cache.h"
 #include "paralleler.h"
+#include "transposition_table.h"
+#include "work_stealing_range.h"
+#include <atomic>
 #include <deque>
 #include <memory>
 #include <mutex>
@@ -13,17 +17,40 @@
 
 namespace minizero::actor {
 
+class PhaseTiming {
+public:
+    PhaseTiming() { reset(); }
+
+    void reset();
+    std::string toString() const;
+
+    int num_cpu_threads_;
+    int num_gpu_threads_;
+    std::atomic<uint64_t> num_rounds_;
+    std::atomic<uint64_t> round_time_;    // wall-clock microseconds of all rounds
+    std::atomic<uint64_t> cpu_job_time_;  // microseconds of tree search, summed over threads
+    std::atomic<uint64_t> gpu_job_time_;  // microseconds of network inference, summed over threads
+};
+
 class ThreadSharedData : public utils::BaseSharedData {
 public:
-    int getAvailableActorIndex();
+    int getCohortBeginIndex(int cohort) const;
+    int getNetworkIndex(int actor_id) const;
+    inline int getNumNetworksPerCohort() const { return networks_.size() / num_cohorts_; }
     void outputGame(const std::shared_ptr<BaseActor>& actor);
     std::pair<int, int> calculateTrainingDataRange(const std::shared_ptr<BaseActor>& actor);
 
     bool do_cpu_job_;
-    int actor_index_;
+    utils::WorkStealingRange actor_range_;
+    int num_cohorts_;
+    int cpu_cohort_; // the cohort doing tree search in this round, -1 for none
+    int gpu_cohort_; // the cohort whose batches are evaluated in this round, -1 for none
+    PhaseTiming phase_timing_;
     std::mutex mutex_;
     std::vector<std::shared_ptr<BaseActor>> actors_;
     std::vector<std::shared_ptr<network::Network>> networks_;
+    std::shared_ptr<TranspositionTable> transposition_table_;
+    std::shared_ptr<network::NNEvaluationCache> nn_evaluation_cache_;
     std::vector<std::vector<std::shared_ptr<network::NetworkOutput>>> network_outputs_;
 };
 
@@ -37,8 +64,9 @@ public:
     bool isDone() override { return false; }
 
 protected:
-    virtual bool doCPUJob();
-    virtual void doGPUJob();
+    virtual void doCPUJobs();
+    virtual void doCPUJob(int actor_id);
+    virtual bool doGPUJob();
     virtual void handleSearchDone(int actor_id);
     inline std::shared_ptr<ThreadSharedData> getSharedData() { return std::static_pointer_cast<ThreadSharedData>(shared_data_); }
 };
@@ -52,6 +80,8 @@ public:
     void summarize() override {}
 
 protected:
+    virtual void runRound();
+    virtual void flushPipeline();
     virtual void createNeuralNetworks();
     virtual void createActors();
     virtual void handleIO();
@@ -63,6 +93,7 @@ protected:
     inline std::shared_ptr<ThreadSharedData> getSharedData() { return std::static_pointer_cast<ThreadSharedData>(shared_data_); }
 
     bool running_;
+    int pipeline_round_;
     std::deque<std::string> commands_;
     std::unordered_set<std::string> ignored_commands_;
 };
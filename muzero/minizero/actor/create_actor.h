@@ -2,15 +2,23 @@
 
 #include "base_actor.h"
 #include "configuration.h"
+#include "transposition_table.h"
 #include "zero_actor.h"
 #include <memory>
 
 namespace minizero::actor {
 
-inline std::shared_ptr<actor::BaseActor> createActor(uint64_t tree_node_size, const std::shared_ptr<network::Network>& network)
+inline std::shared_ptr<TranspositionTable> createTranspositionTable(const std::shared_ptr<network::Network>& network)
+{
+    if (config::actor_mcts_transposition_table_size <= 0 || network->getNetworkTypeName() != "alphazero") { return nullptr; }
+    return std::make_shared<TranspositionTable>(config::actor_mcts_transposition_table_size, network->getActionSize());
+}
+
+inline std::shared_ptr<actor::BaseActor> createActor(uint64_t tree_node_size, const std::shared_ptr<network::Network>& network, const std::shared_ptr<TranspositionTable>& transposition_table = nullptr)
 {
     auto actor = std::make_shared<ZeroActor>(tree_node_size);
     actor->setNetwork(network);
+    actor->setTranspositionTable(transposition_table ? transposition_table : createTranspositionTable(network));
     actor->reset();
     return actor;
 
@@ -2,29 +2,104 @@
 
 #include "configuration.h"
 #include "environment.h"
+#include "puct_kernel.h"
 #include "random.h"
 #include "search.h"
 #include "tree.h"
 #include <algorithm>
+#include <atomic>
 #include <cmath>
 #include <limits>
-#include <map>
+#include <mutex>
 #include <string>
+#include <utility>
 #include <vector>
 
 namespace minizero::actor {
 
+// the multiset of node values for value rescaling, stored as (value, count) pairs sorted by value;
+// updates shift elements within the reserved array, and the bounds are the two ends of the array
+class TreeValueBound {
+public:
+    TreeValueBound() {}
+
+    inline void reset(int capacity)
+    {
+        values_.clear();
+        values_.reserve(capacity);
+    }
+
+    inline void update(float old_value, float new_value)
+    {
+        // the old value is only removed when it exists
+        auto it = std::lower_bound(values_.begin(), values_.end(), old_value, compareValue);
+        if (it != values_.end() && it->first == old_value) {
+            assert(it->second > 0);
+            if (--it->second == 0) { values_.erase(it); }
+        }
+        insert(new_value);
+    }
+
+    inline void insert(float value)
+    {
+        auto it = std::lower_bound(values_.begin(), values_.end(), value, compareValue);
+        if (it != values_.end() && it->first == value) {
+            ++it->second;
+        } else {
+            values_.insert(it, {value, 1});
+        }
+    }
+
+    inline int size() const { return values_.size(); }
+    inline bool empty() const { return values_.empty(); }
+    inline float getLowerBound() const
+    {
+        assert(!empty());
+        return values_.front().first;
+    }
+    inline float getUpperBound() const
+    {
+        assert(!empty());
+        return values_.back().first;
+    }
+
+private:
+    static inline bool compareValue(const std::pair<float, int>& lhs, float value) { return lhs.first < value; }
+
+    std::vector<std::pair<float, int>> values_;
+};
+
 class MCTSNode : public TreeNode {
 public:
+    // mean and count are packed together so that both can be updated by a single compare-and-swap
+    class Statistics {
+    public:
+        float mean_;
+        float count_;
+    };
+
     MCTSNode() { reset(); }
 
+    MCTSNode& operator=(const MCTSNode& node)
+    {
+        TreeNode::operator=(node);
+        hidden_state_data_index_ = node.hidden_state_data_index_;
+        statistics_.store(node.statistics_.load());
+        virtual_loss_.store(node.virtual_loss_.load());
+        policy_ = node.policy_;
+        policy_logit_ = node.policy_logit_;
+        policy_noise_ = node.policy_noise_;
+        value_ = node.value_;
+        reward_ = node.reward_;
+        return *this;
+    }
+
     void reset() override
     {
         num_children_ = 0;
         hidden_state_data_index_ = -1;
-        mean_ = 0.0f;
-        count_ = 0.0f;
-        virtual_loss_ = 0.0f;
+        statistics_.store({0.0f, 0.0f});
+        virtual_loss_.store(0.0f);
         policy_ = 0.0f;
         policy_logit_ = 0.0f;
         policy_noise_ = 0.0f;
@@ -33,46 +108,56 @@ public:
         first_child_ = nullptr;
     }
 
+    // a count dropping to zero only clears the statistics, the children may be searched by other threads
     virtual void add(float value, float weight = 1.0f)
     {
-        if (count_ + weight <= 0) {
-            reset();
-        } else {
-            count_ += weight;
-            mean_ += weight * (value - mean_) / count_;
-        }
+        Statistics old_statistics = statistics_.load(), new_statistics;
+        do {
+            if (old_statistics.count_ + weight <= 0) {
+                new_statistics = {0.0f, 0.0f};
+                continue;
+            }
+            new_statistics.count_ = old_statistics.count_ + weight;
+            new_statistics.mean_ = old_statistics.mean_ + weight * (value - old_statistics.mean_) / new_statistics.count_;
+        } while (!statistics_.compare_exchange_weak(old_statistics, new_statistics));
     }
 
     virtual void remove(float value, float weight = 1.0f)
     {
-        if (count_ + weight <= 0) {
-            reset();
-        } else {
-            count_ -= weight;
-            mean_ -= weight * (value - mean_) / count_;
-        }
+        Statistics old_statistics = statistics_.load(), new_statistics;
+        do {
+            if (old_statistics.count_ + weight <= 0) {
+                new_statistics = {0.0f, 0.0f};
+                continue;
+            }
+            new_statistics.count_ = old_statistics.count_ - weight;
+            new_statistics.mean_ = old_statistics.mean_ - weight * (value - old_statistics.mean_) / new_statistics.count_;
+        } while (!statistics_.compare_exchange_weak(old_statistics, new_statistics));
     }
 
-    virtual float getNormalizedMean(const std::map<float, int>& tree_value_bound) const
+    virtual float getNormalizedMean(const TreeValueBound& tree_value_bound) const
     {
-        float value = reward_ + config::actor_mcts_reward_discount * mean_;
+        const Statistics statistics = statistics_.load();
+        float value = reward_ + config::actor_mcts_reward_discount * statistics.mean_;
         if (config::actor_mcts_value_rescale) {
             if (tree_value_bound.size() < 2) { return 1.0f; }
-            const float value_lower_bound = tree_value_bound.begin()->first;
-            const float value_upper_bound = tree_value_bound.rbegin()->first;
+            const float value_lower_bound = tree_value_bound.getLowerBound();
+            const float value_upper_bound = tree_value_bound.getUpperBound();
             value = (value - value_lower_bound) / (value_upper_bound - value_lower_bound);
             value = fmin(1, fmax(-1, 2 * value - 1)); // normalize to [-1, 1]
         }
-        value = (action_.getPlayer() == env::Player::kPlayer1 ? value : -value); // flip value according to player
-        value = (value * count_ - virtual_loss_) / getCountWithVirtualLoss();    // value with virtual loss
+        value = (action_.getPlayer() == env::Player::kPlayer1 ? value : -value);               // flip value according to player
+        const float virtual_loss = getVirtualLoss();
+        value = (value * statistics.count_ - virtual_loss) / (statistics.count_ + virtual_loss); // value with virtual loss
         return value;
     }
 
-    virtual float getNormalizedPUCTScore(int total_simulation, const std::map<float, int>& tree_value_bound, float init_q_value = -1.0f) const
+    virtual float getNormalizedPUCTScore(int total_simulation, const TreeValueBound& tree_value_bound, float init_q_value = -1.0f) const
     {
+        float count_with_virtual_loss = getCountWithVirtualLoss();
         float puct_bias = config::actor_mcts_puct_init + log((1 + total_simulation + config::actor_mcts_puct_base) / config::actor_mcts_puct_base);
-        float value_u = (puct_bias * getPolicy() * sqrt(total_simulation)) / (1 + getCountWithVirtualLoss());
-        float value_q = (getCountWithVirtualLoss() == 0 ? init_q_value : getNormalizedMean(tree_value_bound));
+        float value_u = (puct_bias * getPolicy() * sqrt(total_simulation)) / (1 + count_with_virtual_loss);
+        float value_q = (count_with_virtual_loss == 0 ? init_q_value : getNormalizedMean(tree_value_bound));
         return value_u + value_q;
     }
 
@@ -85,19 +170,19 @@ public:
             << ", p_noise = " << policy_noise_
             << ", v = " << value_
             << ", r = " << reward_
-            << ", mean = " << mean_
-            << ", count = " << count_;
+            << ", mean = " << getMean()
+            << ", count = " << getCount();
         return oss.str();
     }
 
-    bool displayInTreeLog() const override { return count_ > 0; }
+    bool displayInTreeLog() const override { return getCount() > 0; }
 
     // setter
     inline void setHiddenStateDataIndex(int hidden_state_data_index) { hidden_state_data_index_ = hidden_state_data_index; }
-    inline void setMean(float mean) { mean_ = mean; }
-    inline void setCount(float count) { count_ = count; }
-    inline void addVirtualLoss(float num = 1.0f) { virtual_loss_ += num; }
-    inline void removeVirtualLoss(float num = 1.0f) { virtual_loss_ -= num; }
+    inline void setMean(float mean) { statistics_.store({mean, getCount()}); }
+    inline void setCount(float count) { statistics_.store({getMean(), count}); }
+    inline float addVirtualLoss(float num = 1.0f) { return fetchAdd(virtual_loss_, num); }
+    inline float removeVirtualLoss(float num = 1.0f) { return fetchAdd(virtual_loss_, -num); }
     inline void setPolicy(float policy) { policy_ = policy; }
     inline void setPolicyLogit(float policy_logit) { policy_logit_ = policy_logit; }
     inline void setPolicyNoise(float policy_noise) { policy_noise_ = policy_noise; }
@@ -107,10 +192,11 @@ public:
 
     // getter
     inline int getHiddenStateDataIndex() const { return hidden_state_data_index_; }
-    inline float getMean() const { return mean_; }
-    inline float getCount() const { return count_; }
-    inline float getCountWithVirtualLoss() const { return count_ + virtual_loss_; }
-    inline float getVirtualLoss() const { return virtual_loss_; }
+    inline Statistics getStatistics() const { return statistics_.load(); }
+    inline float getMean() const { return statistics_.load().mean_; }
+    inline float getCount() const { return statistics_.load().count_; }
+    inline float getCountWithVirtualLoss() const { return getCount() + getVirtualLoss(); }
+    inline float getVirtualLoss() const { return virtual_loss_.load(); }
     inline float getPolicy() const { return policy_; }
     inline float getPolicyLogit() const { return policy_logit_; }
     inline float getPolicyNoise() const { return policy_noise_; }
@@ -119,10 +205,17 @@ public:
     inline virtual MCTSNode* getChild(int index) const override { return (index < num_children_ ? static_cast<MCTSNode*>(first_child_) + index : nullptr); }
 
 protected:
+    // returns the value before adding, the same as std::atomic<int>::fetch_add
+    static inline float fetchAdd(std::atomic<float>& target, float num)
+    {
+        float old_value = target.load();
+        while (!target.compare_exchange_weak(old_value, old_value + num)) {}
+        return old_value;
+    }
+
     int hidden_state_data_index_;
-    float mean_;
-    float count_;
-    float virtual_loss_;
+    std::atomic<Statistics> statistics_;
+    std::atomic<float> virtual_loss_;
     float policy_;
     float policy_logit_;
     float policy_noise_;
@@ -132,8 +225,8 @@ protected:
 
 class HiddenStateData {
 public:
-    HiddenStateData(const std::vector<float>& hidden_state)
-        : hidden_state_(hidden_state) {}
+    HiddenStateData(std::vector<float> hidden_state)
+        : hidden_state_(std::move(hidden_state)) {}
     std::vector<float> hidden_state_;
 };
 typedef TreeData<HiddenStateData> TreeHiddenStateData;
@@ -156,7 +249,7 @@ public:
     {
         Tree::reset();
         tree_hidden_state_data_.reset();
-        tree_value_bound_.clear();
+        tree_value_bound_.reset(config::actor_num_simulation + 1);
     }
 
     virtual bool isResign(const MCTSNode* selected_node) const
@@ -252,30 +345,99 @@ public:
         node_path.back()->setReward(reward);
         for (int i = static_cast<int>(node_path.size() - 1); i >= 0; --i) {
             MCTSNode* node = node_path[i];
-            float old_mean = node->getReward() + config::actor_mcts_reward_discount * node->getMean();
-            node->add(updated_value);
-            updateTreeValueBound(old_mean, node->getReward() + config::actor_mcts_reward_discount * node->getMean());
+            if (config::actor_mcts_value_rescale) {
+                // the bound replaces the old mean of the node, so no other thread may update the node in between
+                std::lock_guard<std::mutex> lock(tree_value_bound_mutex_);
+                float old_mean = node->getReward() + config::actor_mcts_reward_discount * node->getMean();
+                node->add(updated_value);
+                updateTreeValueBound(old_mean, node->getReward() + config::actor_mcts_reward_discount * node->getMean());
+            } else {
+                node->add(updated_value);
+            }
             updated_value = node->getReward() + config::actor_mcts_reward_discount * updated_value;
         }
     }
 
+    // keeps only the subtree of new_root and makes it the root; the kept child blocks slide down to the
+    // front of the node pool in their original order, so the pool never grows beyond one search
+    virtual void promoteToRoot(MCTSNode* new_root)
+    {
+        assert(new_root && new_root != getRootNode());
+        class ChildBlock {
+        public:
+            int parent_block_id_;
+            int parent_offset_;
+            int source_;
+            int destination_;
+        };
+
+        // collect the child blocks of the subtree; a block is always allocated after the block containing its parent
+        MCTSNode* nodes = getRootNode();
+        std::vector<ChildBlock> blocks;
+        if (!new_root->isLeaf()) { blocks.push_back({-1, 0, static_cast<int>(new_root->getChild(0) - nodes), 0}); }
+        for (size_t block_id = 0; block_id < blocks.size(); ++block_id) {
+            MCTSNode* first_child = nodes + blocks[block_id].source_;
+            MCTSNode* parent = (blocks[block_id].parent_block_id_ == -1 ? new_root : nodes + blocks[blocks[block_id].parent_block_id_].source_ + blocks[block_id].parent_offset_);
+            for (int i = 0; i < parent->getNumChildren(); ++i) {
+                if (first_child[i].isLeaf()) { continue; }
+                blocks.push_back({static_cast<int>(block_id), i, static_cast<int>(first_child[i].getChild(0) - nodes), 0});
+            }
+        }
+        std::vector<int> order(blocks.size());
+        for (size_t i = 0; i < order.size(); ++i) { order[i] = i; }
+        std::sort(order.begin(), order.end(), [&blocks](int lhs, int rhs) { return blocks[lhs].source_ < blocks[rhs].source_; });
+
+        // moving blocks in ascending order never overwrites a block that has not been moved yet
+        nodes[0] = *new_root;
+        uint64_t node_size = 1;
+        for (int block_id : order) {
+            ChildBlock& block = blocks[block_id];
+            MCTSNode* parent = (block.parent_block_id_ == -1 ? nodes : nodes + blocks[block.parent_block_id_].destination_ + block.parent_offset_);
+            block.destination_ = node_size;
+            for (int i = 0; i < parent->getNumChildren(); ++i) { nodes[block.destination_ + i] = nodes[block.source_ + i]; }
+            parent->setFirstChild(nodes + block.destination_);
+            node_size += parent->getNumChildren();
+        }
+        current_node_size_ = node_size;
+
+        // rebuild the value bound from the kept nodes
+        tree_value_bound_.reset(config::actor_num_simulation + 1);
+        if (config::actor_mcts_value_rescale) {
+            for (uint64_t i = 0; i < node_size; ++i) {
+                if (nodes[i].getCount() == 0) { continue; }
+                tree_value_bound_.insert(nodes[i].getReward() + config::actor_mcts_reward_discount * nodes[i].getMean());
+            }
+        }
+    }
+
     inline MCTSNode* allocateNodes(int size) { return static_cast<MCTSNode*>(Tree::allocateNodes(size)); }
     inline int getNumSimulation() const { return getRootNode()->getCount(); }
-    inline bool reachMaximumSimulation() const { return (getNumSimulation() == config::actor_num_simulation + 1); }
+    inline bool reachMaximumSimulation() const { return (getNumSimulation() >= config::actor_num_simulation + 1); }
     inline MCTSNode* getRootNode() { return static_cast<MCTSNode*>(Tree::getRootNode()); }
     inline const MCTSNode* getRootNode() const { return static_cast<const MCTSNode*>(Tree::getRootNode()); }
     inline TreeHiddenStateData& getTreeHiddenStateData() { return tree_hidden_state_data_; }
     inline const TreeHiddenStateData& getTreeHiddenStateData() const { return tree_hidden_state_data_; }
-    inline std::map<float, int>& getTreeValueBound() { return tree_value_bound_; }
-    inline const std::map<float, int>& getTreeValueBound() const { return tree_value_bound_; }
+    inline TreeValueBound& getTreeValueBound() { return tree_value_bound_; }
+    inline const TreeValueBound& getTreeValueBound() const { return tree_value_bound_; }
 
 protected:
     TreeNode* createTreeNodes(uint64_t tree_node_size) override { return new MCTSNode[tree_node_size]; }
     TreeNode* getNodeIndex(int index) override { return getRootNode() + index; }
 
-    virtual MCTSNode* selectChildByPUCTScore(const MCTSNode* node) const
+    virtual MCTSNode* selectChildByPUCTScore(const MCTSNode* node) const { return selectChildByPUCTKernel(node, PUCTKernel::getType()); }
+
+    virtual MCTSNode* selectChildByPUCTKernel(const MCTSNode* node, PUCTKernelType type) const
     {
         assert(node && !node->isLeaf());
+        if (node->getNumChildren() == 1) { return node->getChild(0); }
+        if (type != PUCTKernelType::kNode) {
+            // gathering the children costs less than scoring them one by one, even for the few children of a 3x3 board
+            thread_local std::vector<float> buffer;
+            PUCTKernel::ChildBlock block = gatherChildBlock(node, buffer);
+            float* scores = buffer.data() + 5 * block.size_;
+            return node->getChild(0) + PUCTKernel::selectChild(type, getPUCTParentTerms(node), block, scores);
+        }
+
         MCTSNode* selected = nullptr;
         int total_simulation = node->getCountWithVirtualLoss() - 1;
         float init_q_value = calculateInitQValue(node);
@@ -292,6 +454,37 @@ protected:
         return selected;
     }
 
+    // copies the children statistics into structure-of-arrays buffers, with space for the scores at the end
+    PUCTKernel::ChildBlock gatherChildBlock(const MCTSNode* node, std::vector<float>& buffer) const
+    {
+        const int num_children = node->getNumChildren();
+        buffer.resize(6 * num_children);
+        float* count = buffer.data();
+        float* virtual_loss = count + num_children;
+        float* mean = virtual_loss + num_children;
+        float* reward = mean + num_children;
+        float* policy = reward + num_children;
+        const MCTSNode* first_child = node->getChild(0);
+        for (int i = 0; i < num_children; ++i) {
+            const MCTSNode* child = first_child + i;
+            const MCTSNode::Statistics statistics = child->getStatistics(); // one load, so that mean and count come from the same update
+            count[i] = statistics.count_;
+            virtual_loss[i] = child->getVirtualLoss();
+            mean[i] = statistics.mean_;
+            reward[i] = child->getReward();
+            policy[i] = child->getPolicy();
+        }
+        return PUCTKernel::ChildBlock{num_children, count, virtual_loss, mean, reward, policy};
+    }
+
+    PUCTKernel::ParentTerms getPUCTParentTerms(const MCTSNode* node) const
+    {
+        const bool is_player1 = (node->getChild(0)->getAction().getPlayer() == env::Player::kPlayer1);
+        const float value_lower_bound = (tree_value_bound_.empty() ? 0.0f : tree_value_bound_.getLowerBound());
+        const float value_upper_bound = (tree_value_bound_.empty() ? 0.0f : tree_value_bound_.getUpperBound());
+        return PUCTKernel::calculateParentTerms(node->getCountWithVirtualLoss() - 1, is_player1, tree_value_bound_.size(), value_lower_bound, value_upper_bound);
+    }
+
     virtual float calculateInitQValue(const MCTSNode* node) const
     {
         // init Q value = avg Q value of all visited children + one loss
@@ -311,18 +504,15 @@ protected:
 #endif
     }
 
+    // called by backup while holding tree_value_bound_mutex_
     virtual void updateTreeValueBound(float old_value, float new_value)
     {
         if (!config::actor_mcts_value_rescale) { return; }
-        if (tree_value_bound_.count(old_value)) {
-            assert(tree_value_bound_[old_value] > 0);
-            --tree_value_bound_[old_value];
-            if (tree_value_bound_[old_value] == 0) { tree_value_bound_.erase(old_value); }
-        }
-        ++tree_value_bound_[new_value];
+        tree_value_bound_.update(old_value, new_value);
     }
 
-    std::map<float, int> tree_value_bound_;
+    std::mutex tree_value_bound_mutex_;
+    TreeValueBound tree_value_bound_;
     TreeHiddenStateData tree_hidden_state_data_;
 };
 
@@ -0,0 +1,287 @@
+#pragma once
+
+#include "configuration.h"
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <limits>
+#include <string>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define PUCT_KERNEL_X86
+#endif
+
+namespace minizero::actor {
+
+enum class PUCTKernelType {
+    kNode,   // score through MCTSNode::getNormalizedPUCTScore
+    kScalar, // score child blocks with plain loops
+    kAVX2,
+    kAVX512
+};
+
+// Scores a whole child block with the same arithmetic as MCTSNode::getNormalizedPUCTScore and
+// MCTS::calculateInitQValue, so that every kernel gives bit-identical scores. The terms depending
+// only on the parent are calculated once, and the per-child value_u stays in double as in the
+// original expression. The SIMD paths must not be contracted into FMA (avx512f implies fma in GCC).
+class PUCTKernel {
+public:
+    class ParentTerms {
+    public:
+        float puct_bias_;
+        double sqrt_total_simulation_;
+        float reward_discount_;
+        float player_sign_;
+        bool value_rescale_;
+        bool use_default_value_;
+        float value_lower_bound_;
+        float value_upper_bound_;
+    };
+
+    class ChildBlock {
+    public:
+        int size_;
+        const float* count_;
+        const float* virtual_loss_;
+        const float* mean_;
+        const float* reward_;
+        const float* policy_;
+    };
+
+    static ParentTerms calculateParentTerms(int total_simulation, bool is_player1, int value_bound_size, float value_lower_bound, float value_upper_bound)
+    {
+        ParentTerms terms;
+        terms.puct_bias_ = config::actor_mcts_puct_init + log((1 + total_simulation + config::actor_mcts_puct_base) / config::actor_mcts_puct_base);
+        terms.sqrt_total_simulation_ = sqrt(total_simulation);
+        terms.reward_discount_ = config::actor_mcts_reward_discount;
+        terms.player_sign_ = (is_player1 ? 1.0f : -1.0f);
+        terms.value_rescale_ = config::actor_mcts_value_rescale;
+        terms.use_default_value_ = (config::actor_mcts_value_rescale && value_bound_size < 2);
+        terms.value_lower_bound_ = value_lower_bound;
+        terms.value_upper_bound_ = value_upper_bound;
+        return terms;
+    }
+
+    // returns the index of the selected child; scores must hold at least block.size_ floats
+    static int selectChild(PUCTKernelType type, const ParentTerms& terms, const ChildBlock& block, float* scores)
+    {
+        calculateScores(getTypeByBlockSize(type, block.size_), terms, block, scores);
+        int selected = -1;
+        float best_score = std::numeric_limits<float>::lowest(), best_policy = std::numeric_limits<float>::lowest();
+        for (int i = 0; i < block.size_; ++i) {
+            if (scores[i] < best_score || (scores[i] == best_score && block.policy_[i] <= best_policy)) { continue; }
+            best_score = scores[i];
+            best_policy = block.policy_[i];
+            selected = i;
+        }
+        assert(selected != -1);
+        return selected;
+    }
+
+    static void calculateScores(PUCTKernelType type, const ParentTerms& terms, const ChildBlock& block, float* scores)
+    {
+        assert(isSupported(type) && type != PUCTKernelType::kNode);
+#ifdef PUCT_KERNEL_X86
+        if (type == PUCTKernelType::kAVX512) {
+            calculateNormalizedMeanAVX512(terms, block, scores);
+            calculatePUCTScoreAVX512(terms, block, calculateInitQValue(block, scores), scores);
+            return;
+        } else if (type == PUCTKernelType::kAVX2) {
+            calculateNormalizedMeanAVX2(terms, block, scores);
+            calculatePUCTScoreAVX2(terms, block, calculateInitQValue(block, scores), scores);
+            return;
+        }
+#endif
+        calculateNormalizedMean(terms, block, 0, scores);
+        calculatePUCTScore(terms, block, calculateInitQValue(block, scores), 0, scores);
+    }
+
+    // the kernel set by actor_mcts_puct_kernel, falling back to the best supported one
+    static PUCTKernelType getType()
+    {
+        static const PUCTKernelType type = getTypeByName(config::actor_mcts_puct_kernel);
+        return type;
+    }
+
+    // the name is validated when loading the configuration; a SIMD kernel the CPU does not support falls back to the next narrower one
+    static PUCTKernelType getTypeByName(const std::string& name)
+    {
+        assert(name == "auto" || name == "node" || name == "scalar" || name == "avx2" || name == "avx512");
+        if (name == "node") { return PUCTKernelType::kNode; }
+        if (name == "scalar") { return PUCTKernelType::kScalar; }
+        if ((name == "auto" || name == "avx512") && isSupported(PUCTKernelType::kAVX512)) { return PUCTKernelType::kAVX512; }
+        if ((name == "auto" || name == "avx512" || name == "avx2") && isSupported(PUCTKernelType::kAVX2)) { return PUCTKernelType::kAVX2; }
+        return PUCTKernelType::kScalar;
+    }
+
+    // a SIMD kernel is slower than the narrower ones on a block smaller than one of its vectors, e.g., the children of a 3x3 board
+    static PUCTKernelType getTypeByBlockSize(PUCTKernelType type, int size)
+    {
+        if (type == PUCTKernelType::kAVX512 && size < 16) { type = (isSupported(PUCTKernelType::kAVX2) ? PUCTKernelType::kAVX2 : PUCTKernelType::kScalar); }
+        if (type == PUCTKernelType::kAVX2 && size < 8) { type = PUCTKernelType::kScalar; }
+        return type;
+    }
+
+    static bool isSupported(PUCTKernelType type)
+    {
+#ifdef PUCT_KERNEL_X86
+        if (type == PUCTKernelType::kAVX512) { return __builtin_cpu_supports("avx512f"); }
+        if (type == PUCTKernelType::kAVX2) { return __builtin_cpu_supports("avx2"); }
+#else
+        if (type == PUCTKernelType::kAVX512 || type == PUCTKernelType::kAVX2) { return false; }
+#endif
+        return true;
+    }
+
+    static std::string getTypeName(PUCTKernelType type)
+    {
+        switch (type) {
+            case PUCTKernelType::kNode: return "node";
+            case PUCTKernelType::kScalar: return "scalar";
+            case PUCTKernelType::kAVX2: return "avx2";
+            case PUCTKernelType::kAVX512: return "avx512";
+            default: return "unknown";
+        }
+    }
+
+private:
+    static inline float calculateInitQValue(const ChildBlock& block, const float* normalized_mean)
+    {
+        // summed in order, as a vectorized sum would round differently
+        float sum_of_win = 0.0f, sum = 0.0f;
+        for (int i = 0; i < block.size_; ++i) {
+            if (block.count_[i] + block.virtual_loss_[i] == 0) { continue; }
+            sum_of_win += normalized_mean[i];
+            sum += 1;
+        }
+#if ATARI
+        return (sum > 0 ? sum_of_win / sum : 1.0f);
+#else
+        return (sum_of_win - 1) / (sum + 1);
+#endif
+    }
+
+    static inline void calculateNormalizedMean(const ParentTerms& terms, const ChildBlock& block, int start, float* scores)
+    {
+        for (int i = start; i < block.size_; ++i) {
+            if (terms.use_default_value_) {
+                scores[i] = 1.0f;
+                continue;
+            }
+            float value = block.reward_[i] + terms.reward_discount_ * block.mean_[i];
+            if (terms.value_rescale_) {
+                value = (value - terms.value_lower_bound_) / (terms.value_upper_bound_ - terms.value_lower_bound_);
+                value = std::min(1.0f, std::max(-1.0f, 2 * value - 1));
+            }
+            value = terms.player_sign_ * value;
+            scores[i] = (value * block.count_[i] - block.virtual_loss_[i]) / (block.count_[i] + block.virtual_loss_[i]);
+        }
+    }
+
+    static inline void calculatePUCTScore(const ParentTerms& terms, const ChildBlock& block, float init_q_value, int start, float* scores)
+    {
+        for (int i = start; i < block.size_; ++i) {
+            const float count_with_virtual_loss = block.count_[i] + block.virtual_loss_[i];
+            const float value_u = (terms.puct_bias_ * block.policy_[i] * terms.sqrt_total_simulation_) / (1 + count_with_virtual_loss);
+            const float value_q = (count_with_virtual_loss == 0 ? init_q_value : scores[i]);
+            scores[i] = value_u + value_q;
+        }
+    }
+
+#ifdef PUCT_KERNEL_X86
+    __attribute__((target("avx2"), optimize("fp-contract=off"))) static void calculateNormalizedMeanAVX2(const ParentTerms& terms, const ChildBlock& block, float* scores)
+    {
+        const __m256 one = _mm256_set1_ps(1.0f), minus_one = _mm256_set1_ps(-1.0f), two = _mm256_set1_ps(2.0f);
+        const __m256 discount = _mm256_set1_ps(terms.reward_discount_);
+        const __m256 sign = _mm256_set1_ps(terms.player_sign_);
+        const __m256 lower_bound = _mm256_set1_ps(terms.value_lower_bound_);
+        const __m256 bound_range = _mm256_set1_ps(terms.value_upper_bound_ - terms.value_lower_bound_);
+        int i = 0;
+        for (; !terms.use_default_value_ && i + 8 <= block.size_; i += 8) {
+            const __m256 count = _mm256_loadu_ps(block.count_ + i);
+            const __m256 virtual_loss = _mm256_loadu_ps(block.virtual_loss_ + i);
+            __m256 value = _mm256_add_ps(_mm256_loadu_ps(block.reward_ + i), _mm256_mul_ps(discount, _mm256_loadu_ps(block.mean_ + i)));
+            if (terms.value_rescale_) {
+                value = _mm256_div_ps(_mm256_sub_ps(value, lower_bound), bound_range);
+                value = _mm256_min_ps(_mm256_max_ps(_mm256_sub_ps(_mm256_mul_ps(two, value), one), minus_one), one);
+            }
+            value = _mm256_mul_ps(sign, value);
+            value = _mm256_div_ps(_mm256_sub_ps(_mm256_mul_ps(value, count), virtual_loss), _mm256_add_ps(count, virtual_loss));
+            _mm256_storeu_ps(scores + i, value);
+        }
+        calculateNormalizedMean(terms, block, i, scores);
+    }
+
+    __attribute__((target("avx2"), optimize("fp-contract=off"))) static void calculatePUCTScoreAVX2(const ParentTerms& terms, const ChildBlock& block, float init_q_value, float* scores)
+    {
+        const __m256 one = _mm256_set1_ps(1.0f), zero = _mm256_setzero_ps();
+        const __m256 puct_bias = _mm256_set1_ps(terms.puct_bias_);
+        const __m256 init_q = _mm256_set1_ps(init_q_value);
+        const __m256d sqrt_total_simulation = _mm256_set1_pd(terms.sqrt_total_simulation_);
+        int i = 0;
+        for (; i + 8 <= block.size_; i += 8) {
+            const __m256 count_with_virtual_loss = _mm256_add_ps(_mm256_loadu_ps(block.count_ + i), _mm256_loadu_ps(block.virtual_loss_ + i));
+            const __m256 bias_policy = _mm256_mul_ps(puct_bias, _mm256_loadu_ps(block.policy_ + i));
+            const __m256 denominator = _mm256_add_ps(one, count_with_virtual_loss);
+            const __m128 value_u_low = _mm256_cvtpd_ps(_mm256_div_pd(_mm256_mul_pd(_mm256_cvtps_pd(_mm256_castps256_ps128(bias_policy)), sqrt_total_simulation),
+                                                                     _mm256_cvtps_pd(_mm256_castps256_ps128(denominator))));
+            const __m128 value_u_high = _mm256_cvtpd_ps(_mm256_div_pd(_mm256_mul_pd(_mm256_cvtps_pd(_mm256_extractf128_ps(bias_policy, 1)), sqrt_total_simulation),
+                                                                      _mm256_cvtps_pd(_mm256_extractf128_ps(denominator, 1))));
+            const __m256 value_u = _mm256_set_m128(value_u_high, value_u_low);
+            const __m256 value_q = _mm256_blendv_ps(_mm256_loadu_ps(scores + i), init_q, _mm256_cmp_ps(count_with_virtual_loss, zero, _CMP_EQ_OQ));
+            _mm256_storeu_ps(scores + i, _mm256_add_ps(value_u, value_q));
+        }
+        calculatePUCTScore(terms, block, init_q_value, i, scores);
+    }
+
+    __attribute__((target("avx512f"), optimize("fp-contract=off"))) static void calculateNormalizedMeanAVX512(const ParentTerms& terms, const ChildBlock& block, float* scores)
+    {
+        const __m512 one = _mm512_set1_ps(1.0f), minus_one = _mm512_set1_ps(-1.0f), two = _mm512_set1_ps(2.0f);
+        const __m512 discount = _mm512_set1_ps(terms.reward_discount_);
+        const __m512 sign = _mm512_set1_ps(terms.player_sign_);
+        const __m512 lower_bound = _mm512_set1_ps(terms.value_lower_bound_);
+        const __m512 bound_range = _mm512_set1_ps(terms.value_upper_bound_ - terms.value_lower_bound_);
+        int i = 0;
+        for (; !terms.use_default_value_ && i + 16 <= block.size_; i += 16) {
+            const __m512 count = _mm512_loadu_ps(block.count_ + i);
+            const __m512 virtual_loss = _mm512_loadu_ps(block.virtual_loss_ + i);
+            __m512 value = _mm512_add_ps(_mm512_loadu_ps(block.reward_ + i), _mm512_mul_ps(discount, _mm512_loadu_ps(block.mean_ + i)));
+            if (terms.value_rescale_) {
+                value = _mm512_div_ps(_mm512_sub_ps(value, lower_bound), bound_range);
+                value = _mm512_min_ps(_mm512_max_ps(_mm512_sub_ps(_mm512_mul_ps(two, value), one), minus_one), one);
+            }
+            value = _mm512_mul_ps(sign, value);
+            value = _mm512_div_ps(_mm512_sub_ps(_mm512_mul_ps(value, count), virtual_loss), _mm512_add_ps(count, virtual_loss));
+            _mm512_storeu_ps(scores + i, value);
+        }
+        calculateNormalizedMean(terms, block, i, scores);
+    }
+
+    __attribute__((target("avx512f"), optimize("fp-contract=off"))) static void calculatePUCTScoreAVX512(const ParentTerms& terms, const ChildBlock& block, float init_q_value, float* scores)
+    {
+        const __m512 one = _mm512_set1_ps(1.0f), zero = _mm512_setzero_ps();
+        const __m512 puct_bias = _mm512_set1_ps(terms.puct_bias_);
+        const __m512 init_q = _mm512_set1_ps(init_q_value);
+        const __m512d sqrt_total_simulation = _mm512_set1_pd(terms.sqrt_total_simulation_);
+        int i = 0;
+        for (; i + 16 <= block.size_; i += 16) {
+            const __m512 count_with_virtual_loss = _mm512_add_ps(_mm512_loadu_ps(block.count_ + i), _mm512_loadu_ps(block.virtual_loss_ + i));
+            const __m512 bias_policy = _mm512_mul_ps(puct_bias, _mm512_loadu_ps(block.policy_ + i));
+            const __m512 denominator = _mm512_add_ps(one, count_with_virtual_loss);
+            const __m512d bias_policy_low = _mm512_cvtps_pd(_mm512_castps512_ps256(bias_policy));
+            const __m512d bias_policy_high = _mm512_cvtps_pd(_mm256_castpd_ps(_mm512_extractf64x4_pd(_mm512_castps_pd(bias_policy), 1)));
+            const __m512d denominator_low = _mm512_cvtps_pd(_mm512_castps512_ps256(denominator));
+            const __m512d denominator_high = _mm512_cvtps_pd(_mm256_castpd_ps(_mm512_extractf64x4_pd(_mm512_castps_pd(denominator), 1)));
+            const __m256 value_u_low = _mm512_cvtpd_ps(_mm512_div_pd(_mm512_mul_pd(bias_policy_low, sqrt_total_simulation), denominator_low));
+            const __m256 value_u_high = _mm512_cvtpd_ps(_mm512_div_pd(_mm512_mul_pd(bias_policy_high, sqrt_total_simulation), denominator_high));
+            const __m512 value_u = _mm512_castpd_ps(_mm512_insertf64x4(_mm512_castps_pd(_mm512_castps256_ps512(value_u_low)), _mm256_castps_pd(value_u_high), 1));
+            const __mmask16 is_unvisited = _mm512_cmp_ps_mask(count_with_virtual_loss, zero, _CMP_EQ_OQ);
+            const __m512 value_q = _mm512_mask_blend_ps(is_unvisited, _mm512_loadu_ps(scores + i), init_q);
+            _mm512_storeu_ps(scores + i, _mm512_add_ps(value_u, value_q));
+        }
+        calculatePUCTScore(terms, block, init_q_value, i, scores);
+    }
+#endif
+};
+
+} // namespace minizero::actor
@@ -0,0 +1,95 @@
+#pragma once
+
+#include "alphazero_network.h"
+#include "rotation.h"
+#include <atomic>
+#include <cassert>
+#include <cstdint>
+#include <memory>
+
+namespace minizero::actor {
+
+// a fixed-size table of alphazero network outputs, keyed by the environment hash key and the feature rotation
+// each entry is guarded by a sequence number, so neither lookups nor stores ever wait for each other:
+// a lookup racing with a store misses, and a store racing with another store on the same entry is dropped
+class TranspositionTable {
+public:
+    TranspositionTable(int num_entries, int policy_size)
+        : policy_size_(policy_size)
+    {
+        assert(num_entries > 0 && policy_size > 0);
+        num_entries_ = 1;
+        while (num_entries_ < static_cast<uint64_t>(num_entries)) { num_entries_ <<= 1; }
+        entry_size_ = 1 + 2 * policy_size_; // value, policy, policy logits
+        sequences_ = std::make_unique<std::atomic<uint64_t>[]>(num_entries_);
+        keys_ = std::make_unique<std::atomic<uint64_t>[]>(num_entries_);
+        data_ = std::make_unique<std::atomic<float>[]>(num_entries_ * entry_size_);
+        clear();
+    }
+
+    static inline uint64_t getKey(uint64_t hash_key, utils::Rotation rotation)
+    {
+        uint64_t key = hash_key ^ ((static_cast<uint64_t>(rotation) + 1) * 0x9e3779b97f4a7c15ULL);
+        key = (key ^ (key >> 30)) * 0xbf58476d1ce4e5b9ULL;
+        key = (key ^ (key >> 27)) * 0x94d049bb133111ebULL;
+        return key ^ (key >> 31);
+    }
+
+    std::shared_ptr<network::AlphaZeroNetworkOutput> lookup(uint64_t key) const
+    {
+        const uint64_t index = key & (num_entries_ - 1);
+        const uint64_t sequence = sequences_[index].load(std::memory_order_acquire);
+        if (sequence == 0 || (sequence & 1) || keys_[index].load(std::memory_order_relaxed) != key) { return nullptr; }
+
+        auto output = std::make_shared<network::AlphaZeroNetworkOutput>(policy_size_);
+        const std::atomic<float>* data = &data_[index * entry_size_];
+        output->value_ = data[0].load(std::memory_order_relaxed);
+        for (int i = 0; i < policy_size_; ++i) {
+            output->policy_[i] = data[1 + i].load(std::memory_order_relaxed);
+            output->policy_logits_[i] = data[1 + policy_size_ + i].load(std::memory_order_relaxed);
+        }
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (sequences_[index].load(std::memory_order_relaxed) != sequence) { return nullptr; }
+        return output;
+    }
+
+    void store(uint64_t key, const network::AlphaZeroNetworkOutput& output)
+    {
+        assert(static_cast<int>(output.policy_.size()) == policy_size_ && static_cast<int>(output.policy_logits_.size()) == policy_size_);
+        const uint64_t index = key & (num_entries_ - 1);
+        uint64_t sequence = sequences_[index].load(std::memory_order_relaxed);
+        if ((sequence & 1) || !sequences_[index].compare_exchange_strong(sequence, sequence + 1, std::memory_order_acquire, std::memory_order_relaxed)) { return; }
+        std::atomic_thread_fence(std::memory_order_release);
+
+        keys_[index].store(key, std::memory_order_relaxed);
+        std::atomic<float>* data = &data_[index * entry_size_];
+        data[0].store(output.value_, std::memory_order_relaxed);
+        for (int i = 0; i < policy_size_; ++i) {
+            data[1 + i].store(output.policy_[i], std::memory_order_relaxed);
+            data[1 + policy_size_ + i].store(output.policy_logits_[i], std::memory_order_relaxed);
+        }
+        sequences_[index].store(sequence + 2, std::memory_order_release);
+    }
+
+    // must not run concurrently with lookups or stores, e.g., when loading a new model
+    void clear()
+    {
+        for (uint64_t i = 0; i < num_entries_; ++i) {
+            sequences_[i].store(0, std::memory_order_relaxed);
+            keys_[i].store(0, std::memory_order_relaxed);
+        }
+    }
+
+    inline uint64_t getNumEntries() const { return num_entries_; }
+    inline int getPolicySize() const { return policy_size_; }
+
+private:
+    int policy_size_;
+    uint64_t num_entries_;
+    uint64_t entry_size_;
+    std::unique_ptr<std::atomic<uint64_t>[]> sequences_;
+    std::unique_ptr<std::atomic<uint64_t>[]> keys_;
+    std::unique_ptr<std::atomic<float>[]> data_;
+};
+
+} // namespace minizero::actor
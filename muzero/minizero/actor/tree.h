@@ -1,6 +1,8 @@
 #pragma once
 
+#include <atomic>
 #include <cassert>
+#include <mutex>
 #include <string>
 #include <vector>
 
@@ -14,6 +16,7 @@ public:
     inline void reset() { data_.clear(); }
     inline int store(const Data& data)
     {
+        std::lock_guard<std::mutex> lock(mutex_);
         int index = data_.size();
         data_.push_back(data);
         return index;
@@ -26,6 +29,7 @@ public:
     inline int size() const { return data_.size(); }
 
 private:
+    std::mutex mutex_;
     std::vector<Data> data_;
 };
 
@@ -70,10 +74,10 @@ public:
 
     inline TreeNode* allocateNodes(int size)
     {
-        assert(current_node_size_ + size <= tree_node_size_);
-        TreeNode* node = getNodeIndex(current_node_size_);
-        current_node_size_ += size;
-        return node;
+        // nodes can be allocated by several search threads at once
+        uint64_t index = current_node_size_.fetch_add(size);
+        assert(index + size <= tree_node_size_);
+        return getNodeIndex(index);
     }
 
     std::string toString(const std::string& env_string)
@@ -117,7 +121,7 @@ protected:
     virtual TreeNode* getNodeIndex(int index) = 0;
 
     uint64_t tree_node_size_;
-    uint64_t current_node_size_;
+    std::atomic<uint64_t> current_node_size_;
     TreeNode* nodes_;
 };
 
@@ -2,7 +2,9 @@
 #include "random.h"
 #include "time_system.h"
 #include <algorithm>
+#include <functional>
 #include <memory>
+#include <random>
 #include <unordered_map>
 #include <utility>
 #include <vector>
@@ -19,6 +21,28 @@ void MCTSSearchData::clear()
     node_path_.clear();
 }
 
+void SearchSlaveThread::initialize()
+{
+    int seed = config::program_auto_seed ? std::random_device()() : config::program_seed + id_;
+    utils::Random::seed(seed);
+}
+
+void SearchSlaveThread::runJob()
+{
+    std::shared_ptr<SearchSharedData> shared_data = getSharedData();
+    int begin, end;
+    while (shared_data->job_range_.next(id_, begin, end)) {
+        for (int job_id = begin; job_id < end; ++job_id) { shared_data->job_(job_id); }
+    }
+}
+
+void SearchParalleler::runJobs(int num_jobs, const std::function<void(int)>& job)
+{
+    getSharedData()->job_range_.assign(0, num_jobs);
+    getSharedData()->job_ = job;
+    run();
+}
+
 void ZeroActor::reset()
 {
     BaseActor::reset();
@@ -27,9 +51,19 @@ void ZeroActor::reset()
 
 void ZeroActor::resetSearch()
 {
-    BaseActor::resetSearch();
-    mcts_search_data_.node_path_.clear();
+    MCTSNode* reusable_node = findReusableNode();
+    if (reusable_node) {
+        nn_evaluation_batch_id_ = -1;
+        getMCTS()->promoteToRoot(reusable_node);
+    } else {
+        BaseActor::resetSearch();
+    }
+    num_reused_simulation_ = getMCTS()->getNumSimulation();
+    tree_action_history_ = env_.getActionHistory();
+    mcts_search_data_.clear();
     getMCTS()->getRootNode()->setAction(Action(-1, env::getPreviousPlayer(env_.getTurn(), env_.getNumPlayer())));
+    if (reusable_node && !getMCTS()->getRootNode()->isLeaf()) { addNoiseToNodeChildren(getMCTS()->getRootNode()); }
+    if (isSearchDone()) { handleSearchDone(); } // the reused tree may already have enough simulations
 }
 
 Action ZeroActor::think(bool with_play /*= false*/, bool display_board /*= false*/)
@@ -49,51 +83,28 @@ Action ZeroActor::think(bool with_play /*= false*/, bool display_board /*= false
 
 void ZeroActor::beforeNNEvaluation()
 {
-    mcts_search_data_.node_path_ = selection();
-    if (alphazero_network_) {
-        Environment env_transition = getEnvironmentTransition(mcts_search_data_.node_path_);
-        feature_rotation_ = config::actor_use_random_rotation_features ? static_cast<utils::Rotation>(utils::Random::randInt() % static_cast<int>(utils::Rotation::kRotateSize)) : utils::Rotation::kRotationNone;
-        nn_evaluation_batch_id_ = alphazero_network_->pushBack(env_transition.getFeatures(feature_rotation_));
-    } else if (muzero_network_) {
-        if (getMCTS()->getNumSimulation() == 0) { // initial inference for root node
-            nn_evaluation_batch_id_ = muzero_network_->pushBackInitialData(env_.getFeatures());
-        } else { // for non-root nodes
-            const std::vector<MCTSNode*>& node_path = mcts_search_data_.node_path_;
-            MCTSNode* leaf_node = node_path.back();
-            MCTSNode* parent_node = node_path[node_path.size() - 2];
-            assert(parent_node && parent_node->getHiddenStateDataIndex() != -1);
-            const std::vector<float>& hidden_state = getMCTS()->getTreeHiddenStateData().getData(parent_node->getHiddenStateDataIndex()).hidden_state_;
-            nn_evaluation_batch_id_ = muzero_network_->pushBackRecurrentData(hidden_state, env_.getActionFeatures(leaf_node->getAction()));
+    // leaves found in the transposition table are expanded right away, only a leaf missing from the table waits for the network
+    nn_evaluation_batch_id_ = -1;
+    while (!isSearchDone()) {
+        mcts_search_data_.node_path_ = selection();
+        feature_rotation_ = getFeatureRotation();
+        const Environment& env_transition = getEnvironmentTransition(mcts_search_data_.node_path_, mcts_search_data_.env_transition_);
+        if (useTranspositionTable()) {
+            std::shared_ptr<NetworkOutput> network_output = lookupTranspositionTable(env_transition, feature_rotation_, transposition_key_);
+            if (network_output) {
+                applyNNEvaluation(network_output);
+                continue;
+            }
         }
-    } else {
-        assert(false);
+        nn_evaluation_batch_id_ = pushBackNNEvaluation(mcts_search_data_.node_path_, env_transition, feature_rotation_);
+        return;
     }
 }
 
 void ZeroActor::afterNNEvaluation(const std::shared_ptr<NetworkOutput>& network_output)
 {
-    const std::vector<MCTSNode*>& node_path = mcts_search_data_.node_path_;
-    MCTSNode* leaf_node = node_path.back();
-    if (alphazero_network_) {
-        Environment env_transition = getEnvironmentTransition(node_path);
-        if (!env_transition.isTerminal()) {
-            std::shared_ptr<AlphaZeroNetworkOutput> alphazero_output = std::static_pointer_cast<AlphaZeroNetworkOutput>(network_output);
-            getMCTS()->expand(leaf_node, calculateAlphaZeroActionPolicy(env_transition, alphazero_output, feature_rotation_));
-            getMCTS()->backup(node_path, alphazero_output->value_, env_transition.getReward());
-        } else {
-            getMCTS()->backup(node_path, env_transition.getEvalScore(), env_transition.getReward());
-        }
-    } else if (muzero_network_) {
-        std::shared_ptr<MuZeroNetworkOutput> muzero_output = std::static_pointer_cast<MuZeroNetworkOutput>(network_output);
-        getMCTS()->expand(leaf_node, calculateMuZeroActionPolicy(leaf_node, muzero_output));
-        getMCTS()->backup(node_path, muzero_output->value_, muzero_output->reward_);
-        leaf_node->setHiddenStateDataIndex(getMCTS()->getTreeHiddenStateData().store(HiddenStateData(muzero_output->hidden_state_)));
-    } else {
-        assert(false);
-    }
-    if (leaf_node == getMCTS()->getRootNode()) { addNoiseToNodeChildren(leaf_node); }
-    if (isSearchDone()) { handleSearchDone(); }
-    if (config::actor_use_gumbel) { gumbel_zero_.sequentialHalving(getMCTS()); }
+    if (useTranspositionTable()) { transposition_table_->store(transposition_key_, *std::static_pointer_cast<AlphaZeroNetworkOutput>(network_output)); }
+    applyNNEvaluation(network_output);
 }
 
 void ZeroActor::setNetwork(const std::shared_ptr<network::Network>& network)
@@ -130,27 +141,134 @@ void ZeroActor::step()
     assert(alphazero_network_ || muzero_network_);
     int num_simulation = getMCTS()->getNumSimulation();
     int num_simulation_left = config::actor_num_simulation + 1 - num_simulation;
-    int batch_size = std::min(config::actor_mcts_think_batch_size,
+    // the search threads split the selection batch, so every thread selects at least one leaf per step
+    int batch_size = std::min(std::max(config::actor_mcts_think_batch_size, getNumSearchThreads()),
                               (alphazero_network_ || num_simulation > 0) ? num_simulation_left : 1 /* initial inference for root node */);
     assert(batch_size > 0);
-    std::vector<std::pair<int, decltype(mcts_search_data_.node_path_)>> node_path_evaluated;
-    for (int batch_id = 0; batch_id < batch_size; batch_id++) {
-        beforeNNEvaluation();
-        assert(nn_evaluation_batch_id_ == batch_id);
-        if (mcts_search_data_.node_path_.back()->getVirtualLoss() == 0) {
-            node_path_evaluated.emplace_back(batch_id, std::move(mcts_search_data_.node_path_));
+    evaluations_.resize(batch_size); // kept across steps, so that the environments of the leaves reuse their storage
+    for (int batch_id = 0; batch_id < batch_size; ++batch_id) { evaluations_[batch_id].keep_env_transition_ = (batch_id < config::actor_mcts_think_env_cache_size); }
+    runSearchJobs(batch_size, [this](int batch_id) { prepareEvaluation(evaluations_[batch_id]); });
+    std::vector<std::shared_ptr<NetworkOutput>> network_output;
+    if (alphazero_network_) {
+        if (alphazero_network_->getBatchSize() > 0) { network_output = alphazero_network_->forward(); } // all leaves may be found in the transposition table
+    } else {
+        network_output = (num_simulation == 0 ? muzero_network_->initialInference() : muzero_network_->recurrentInference());
+    }
+    runSearchJobs(batch_size, [this, &network_output](int batch_id) { finishEvaluation(evaluations_[batch_id], network_output); });
+    if (isSearchDone()) { handleSearchDone(); }
+}
+
+void ZeroActor::applyNNEvaluation(const std::shared_ptr<NetworkOutput>& network_output)
+{
+    const Environment& env_transition = (alphazero_network_ ? *mcts_search_data_.env_transition_ : env_);
+    updateTree(mcts_search_data_.node_path_, env_transition, network_output, feature_rotation_);
+    if (isSearchDone()) { handleSearchDone(); }
+    if (config::actor_use_gumbel) { gumbel_zero_.sequentialHalving(getMCTS()); }
+}
+
+void ZeroActor::runSearchJobs(int num_jobs, const std::function<void(int)>& job)
+{
+    if (getNumSearchThreads() == 1) {
+        for (int job_id = 0; job_id < num_jobs; ++job_id) { job(job_id); }
+        return;
+    }
+
+    if (!search_paralleler_) { search_paralleler_ = std::make_shared<SearchParalleler>(config::actor_mcts_think_num_threads); }
+    search_paralleler_->runJobs(num_jobs, job);
+}
+
+void ZeroActor::prepareEvaluation(MCTSEvaluationData& evaluation_data)
+{
+    // only the first path reaching a leaf evaluates it, the others just keep the virtual loss until the batch ends
+    std::vector<MCTSNode*>& node_path = evaluation_data.node_path_;
+    node_path = selection();
+    evaluation_data.need_evaluation_ = (node_path.back()->addVirtualLoss() == 0);
+    for (size_t i = 0; i < node_path.size() - 1; ++i) { node_path[i]->addVirtualLoss(); }
+    if (!evaluation_data.need_evaluation_) { return; }
+
+    evaluation_data.feature_rotation_ = getFeatureRotation();
+    evaluation_data.network_output_ = nullptr;
+    const Environment& env_transition = getEvaluationEnvironment(evaluation_data, false);
+    if (useTranspositionTable()) {
+        evaluation_data.network_output_ = lookupTranspositionTable(env_transition, evaluation_data.feature_rotation_, evaluation_data.transposition_key_);
+        if (evaluation_data.network_output_) { return; }
+    }
+    evaluation_data.batch_index_ = pushBackNNEvaluation(node_path, env_transition, evaluation_data.feature_rotation_);
+}
+
+void ZeroActor::finishEvaluation(MCTSEvaluationData& evaluation_data, const std::vector<std::shared_ptr<NetworkOutput>>& network_outputs)
+{
+    if (!evaluation_data.need_evaluation_) { return; }
+
+    const std::vector<MCTSNode*>& node_path = evaluation_data.node_path_;
+    std::shared_ptr<NetworkOutput> network_output = evaluation_data.network_output_;
+    if (!network_output) {
+        network_output = network_outputs[evaluation_data.batch_index_];
+        if (useTranspositionTable()) { transposition_table_->store(evaluation_data.transposition_key_, *std::static_pointer_cast<AlphaZeroNetworkOutput>(network_output)); }
+    }
+    const Environment& env_transition = getEvaluationEnvironment(evaluation_data, true);
+    updateTree(node_path, env_transition, network_output, evaluation_data.feature_rotation_);
+    float virtual_loss = node_path.back()->getVirtualLoss();
+    for (auto node : node_path) { node->removeVirtualLoss(virtual_loss); }
+    if (config::actor_use_gumbel) { gumbel_zero_.sequentialHalving(getMCTS()); }
+}
+
+int ZeroActor::pushBackNNEvaluation(const std::vector<MCTSNode*>& node_path, const Environment& env_transition, const utils::Rotation& rotation)
+{
+    if (alphazero_network_) {
+        if (alphazero_network_->getEvaluationCache()) { return alphazero_network_->pushBack(env_transition.getFeatures(rotation)); }
+
+        // without the evaluation cache, the features are not hashed, so they are written straight into the network input
+        float* features;
+        int index = alphazero_network_->reserveInput(features);
+        env_transition.writeFeatures(features, rotation);
+        return index;
+    } else if (muzero_network_) {
+        if (getMCTS()->getNumSimulation() == 0) { // initial inference for root node
+            float* features;
+            int index = muzero_network_->reserveInitialInput(features);
+            env_.writeFeatures(features);
+            return index;
+        } else { // for non-root nodes
+            MCTSNode* leaf_node = node_path.back();
+            MCTSNode* parent_node = node_path[node_path.size() - 2];
+            assert(parent_node && parent_node->getHiddenStateDataIndex() != -1);
+            const std::vector<float>& hidden_state = getMCTS()->getTreeHiddenStateData().getData(parent_node->getHiddenStateDataIndex()).hidden_state_;
+            return muzero_network_->pushBackRecurrentData(hidden_state, env_.getActionFeatures(leaf_node->getAction()));
         }
-        for (auto node : mcts_search_data_.node_path_) { node->addVirtualLoss(); }
     }
-    auto network_output = alphazero_network_ ? alphazero_network_->forward()
-                                             : (num_simulation == 0 ? muzero_network_->initialInference() : muzero_network_->recurrentInference());
-    for (auto& evaluation : node_path_evaluated) {
-        nn_evaluation_batch_id_ = evaluation.first;
-        mcts_search_data_.node_path_ = std::move(evaluation.second);
-        afterNNEvaluation(network_output[nn_evaluation_batch_id_]);
-        auto virtual_loss = mcts_search_data_.node_path_.back()->getVirtualLoss();
-        for (auto node : mcts_search_data_.node_path_) { node->removeVirtualLoss(virtual_loss); }
+
+    assert(false);
+    return -1;
+}
+
+void ZeroActor::updateTree(const std::vector<MCTSNode*>& node_path, const Environment& env_transition, const std::shared_ptr<NetworkOutput>& network_output, const utils::Rotation& rotation)
+{
+    MCTSNode* leaf_node = node_path.back();
+    if (alphazero_network_) {
+        if (!env_transition.isTerminal()) {
+            std::shared_ptr<AlphaZeroNetworkOutput> alphazero_output = std::static_pointer_cast<AlphaZeroNetworkOutput>(network_output);
+            getMCTS()->expand(leaf_node, calculateAlphaZeroActionPolicy(env_transition, alphazero_output, rotation));
+            getMCTS()->backup(node_path, alphazero_output->value_, env_transition.getReward());
+        } else {
+            getMCTS()->backup(node_path, env_transition.getEvalScore(), env_transition.getReward());
+        }
+    } else if (muzero_network_) {
+        std::shared_ptr<MuZeroNetworkOutput> muzero_output = std::static_pointer_cast<MuZeroNetworkOutput>(network_output);
+        getMCTS()->expand(leaf_node, calculateMuZeroActionPolicy(leaf_node, muzero_output));
+        getMCTS()->backup(node_path, muzero_output->value_, muzero_output->reward_);
+        leaf_node->setHiddenStateDataIndex(getMCTS()->getTreeHiddenStateData().store(HiddenStateData(muzero_output->hidden_state_.toVector())));
+    } else {
+        assert(false);
     }
+    if (leaf_node == getMCTS()->getRootNode()) { addNoiseToNodeChildren(leaf_node); }
+}
+
+std::shared_ptr<NetworkOutput> ZeroActor::lookupTranspositionTable(const Environment& env_transition, const utils::Rotation& rotation, uint64_t& transposition_key)
+{
+    assert(useTranspositionTable());
+    transposition_key = TranspositionTable::getKey(env_transition.getTranspositionKey(), rotation);
+    return transposition_table_->lookup(transposition_key);
 }
 
 void ZeroActor::handleSearchDone()
@@ -165,7 +283,11 @@ void ZeroActor::handleSearchDone()
         << " (" << action.getActionID() << ")"
         << ", reward: " << env_.getReward()
         << ", player: " << env::playerToChar(action.getPlayer());
-    if (config::actor_mcts_value_rescale) { oss << ", value bound: (" << getMCTS()->getTreeValueBound().begin()->first << ", " << getMCTS()->getTreeValueBound().rbegin()->first << ")"; }
+    if (config::actor_mcts_reuse_tree) {
+        float reuse_ratio = num_reused_simulation_ / getMCTS()->getRootNode()->getCount();
+        oss << ", reused simulations: " << num_reused_simulation_ << " (" << reuse_ratio * 100 << "%)";
+    }
+    if (config::actor_mcts_value_rescale) { oss << ", value bound: (" << getMCTS()->getTreeValueBound().getLowerBound() << ", " << getMCTS()->getTreeValueBound().getUpperBound() << ")"; }
     oss << std::endl
         << "  root node info: " << getMCTS()->getRootNode()->toString() << std::endl
         << "action node info: " << mcts_search_data_.selected_node_->toString() << std::endl;
@@ -188,6 +310,34 @@ MCTSNode* ZeroActor::decideActionNode()
     }
 }
 
+MCTSNode* ZeroActor::findReusableNode()
+{
+    // only the AlphaZero tree is reused: MuZero filters illegal actions at the root only,
+    // and gumbel zero collects its candidates from the first root expansion
+    if (!config::actor_mcts_reuse_tree || !search_ || !alphazero_network_ || config::actor_use_gumbel) { return nullptr; }
+
+    // the tree must have been built on a prefix of the current game
+    const std::vector<Action>& action_history = env_.getActionHistory();
+    if (action_history.size() <= tree_action_history_.size()) { return nullptr; }
+    for (size_t i = 0; i < tree_action_history_.size(); ++i) {
+        if (action_history[i].getActionID() != tree_action_history_[i].getActionID() || action_history[i].getPlayer() != tree_action_history_[i].getPlayer()) { return nullptr; }
+    }
+
+    MCTSNode* node = getMCTS()->getRootNode();
+    for (size_t i = tree_action_history_.size(); i < action_history.size(); ++i) {
+        MCTSNode* next_node = nullptr;
+        for (int child_id = 0; child_id < node->getNumChildren(); ++child_id) {
+            MCTSNode* child = node->getChild(child_id);
+            if (child->getAction().getActionID() != action_history[i].getActionID()) { continue; }
+            next_node = child;
+            break;
+        }
+        if (!next_node || next_node->isLeaf()) { return nullptr; }
+        node = next_node;
+    }
+    return node;
+}
+
 void ZeroActor::addNoiseToNodeChildren(MCTSNode* node)
 {
     assert(node && node->getNumChildren() > 0);
@@ -209,6 +359,12 @@ void ZeroActor::addNoiseToNodeChildren(MCTSNode* node)
     }
 }
 
+utils::Rotation ZeroActor::getFeatureRotation() const
+{
+    if (!alphazero_network_ || !config::actor_use_random_rotation_features) { return utils::Rotation::kRotationNone; }
+    return static_cast<utils::Rotation>(utils::Random::randInt() % static_cast<int>(utils::Rotation::kRotateSize));
+}
+
 std::vector<MCTS::ActionCandidate> ZeroActor::calculateAlphaZeroActionPolicy(const Environment& env_transition, const std::shared_ptr<network::AlphaZeroNetworkOutput>& alphazero_output, const utils::Rotation& rotation)
 {
     assert(alphazero_network_);
@@ -241,11 +397,31 @@ std::vector<MCTS::ActionCandidate> ZeroActor::calculateMuZeroActionPolicy(MCTSNo
     return action_candidates;
 }
 
-Environment ZeroActor::getEnvironmentTransition(const std::vector<MCTSNode*>& node_path)
+const Environment& ZeroActor::getEnvironmentTransition(const std::vector<MCTSNode*>& node_path, std::shared_ptr<Environment>& env_transition)
 {
-    Environment env = env_;
-    for (size_t i = 1; i < node_path.size(); ++i) { env.act(node_path[i]->getAction()); }
-    return env;
+    // MuZero never plays the actions below the root in the real environment
+    if (!alphazero_network_) { return env_; }
+
+    // the leaf environment is played once per simulation, into the environment kept from the previous simulations when there is one
+    if (env_transition) {
+        *env_transition = env_;
+    } else {
+        env_transition = std::make_shared<Environment>(env_);
+    }
+    for (size_t i = 1; i < node_path.size(); ++i) { env_transition->act(node_path[i]->getAction()); }
+    return *env_transition;
+}
+
+const Environment& ZeroActor::getEvaluationEnvironment(MCTSEvaluationData& evaluation_data, bool is_prepared)
+{
+    // only the first actor_mcts_think_env_cache_size evaluations of a batch keep their leaf environments until the tree update,
+    // the others share one environment per thread and play their paths again, which bounds the memory for a large batch
+    if (evaluation_data.keep_env_transition_) {
+        if (is_prepared && alphazero_network_) { return *evaluation_data.env_transition_; }
+        return getEnvironmentTransition(evaluation_data.node_path_, evaluation_data.env_transition_);
+    }
+    thread_local std::shared_ptr<Environment> env_transition;
+    return getEnvironmentTransition(evaluation_data.node_path_, env_transition);
 }
 
 } // namespace minizero::actor
@@ -5,6 +5,10 @@
 #include "gumbel_zero.h"
 #include "mcts.h"
 #include "muzero_network.h"
+#include "paralleler.h"
+#include "transposition_table.h"
+#include "work_stealing_range.h"
+#include <functional>
 #include <memory>
 #include <string>
 #include <unordered_map>
@@ -18,9 +22,59 @@ public:
     std::string search_info_;
     MCTSNode* selected_node_;
     std::vector<MCTSNode*> node_path_;
+    std::shared_ptr<Environment> env_transition_;
     void clear();
 };
 
+class MCTSEvaluationData {
+public:
+    bool need_evaluation_;
+    bool keep_env_transition_;
+    int batch_index_;
+    uint64_t transposition_key_;
+    utils::Rotation feature_rotation_;
+    std::vector<MCTSNode*> node_path_;
+    std::shared_ptr<Environment> env_transition_;
+    std::shared_ptr<network::NetworkOutput> network_output_;
+};
+
+class SearchSharedData : public utils::BaseSharedData {
+public:
+    utils::WorkStealingRange job_range_;
+    std::function<void(int)> job_;
+};
+
+class SearchSlaveThread : public utils::BaseSlaveThread {
+public:
+    SearchSlaveThread(int id, std::shared_ptr<utils::BaseSharedData> shared_data)
+        : BaseSlaveThread(id, shared_data) {}
+
+    void initialize() override;
+    void runJob() override;
+    bool isDone() override { return false; }
+
+protected:
+    inline std::shared_ptr<SearchSharedData> getSharedData() { return std::static_pointer_cast<SearchSharedData>(shared_data_); }
+};
+
+class SearchParalleler : public utils::BaseParalleler {
+public:
+    SearchParalleler(int num_threads)
+    {
+        createSlaveThreads(num_threads);
+        getSharedData()->job_range_.reset(num_threads);
+    }
+
+    void runJobs(int num_jobs, const std::function<void(int)>& job);
+    void initialize() override {}
+    void summarize() override { getSharedData()->job_ = nullptr; }
+
+protected:
+    void createSharedData() override { shared_data_ = std::make_shared<SearchSharedData>(); }
+    std::shared_ptr<utils::BaseSlaveThread> newSlaveThread(int id) override { return std::make_shared<SearchSlaveThread>(id, shared_data_); }
+    inline std::shared_ptr<SearchSharedData> getSharedData() { return std::static_pointer_cast<SearchSharedData>(shared_data_); }
+};
+
 class ZeroActor : public BaseActor {
 public:
     ZeroActor(uint64_t tree_node_size)
@@ -40,6 +94,7 @@ public:
     bool isResign() const override { return enable_resign_ && getMCTS()->isResign(mcts_search_data_.selected_node_); }
     std::string getSearchInfo() const override { return mcts_search_data_.search_info_; }
     void setNetwork(const std::shared_ptr<network::Network>& network) override;
+    void setTranspositionTable(const std::shared_ptr<TranspositionTable>& transposition_table) { transposition_table_ = transposition_table; }
     std::shared_ptr<Search> createSearch() override { return std::make_shared<MCTS>(tree_node_size_); }
     std::shared_ptr<MCTS> getMCTS() { return std::static_pointer_cast<MCTS>(search_); }
     const std::shared_ptr<MCTS> getMCTS() const { return std::static_pointer_cast<MCTS>(search_); }
@@ -51,20 +106,39 @@ protected:
     std::string getEnvReward() const override;
 
     virtual void step();
+    virtual void applyNNEvaluation(const std::shared_ptr<network::NetworkOutput>& network_output);
+    virtual void runSearchJobs(int num_jobs, const std::function<void(int)>& job);
+    virtual void prepareEvaluation(MCTSEvaluationData& evaluation_data);
+    virtual void finishEvaluation(MCTSEvaluationData& evaluation_data, const std::vector<std::shared_ptr<network::NetworkOutput>>& network_outputs);
+    virtual int pushBackNNEvaluation(const std::vector<MCTSNode*>& node_path, const Environment& env_transition, const utils::Rotation& rotation);
+    virtual void updateTree(const std::vector<MCTSNode*>& node_path, const Environment& env_transition, const std::shared_ptr<network::NetworkOutput>& network_output, const utils::Rotation& rotation);
+    virtual std::shared_ptr<network::NetworkOutput> lookupTranspositionTable(const Environment& env_transition, const utils::Rotation& rotation, uint64_t& transposition_key);
     virtual void handleSearchDone();
     virtual MCTSNode* decideActionNode();
+    virtual MCTSNode* findReusableNode();
     virtual void addNoiseToNodeChildren(MCTSNode* node);
     virtual std::vector<MCTSNode*> selection() { return (config::actor_use_gumbel ? gumbel_zero_.selection(getMCTS()) : getMCTS()->select()); }
 
+    utils::Rotation getFeatureRotation() const;
+    // gumbel zero keeps its candidates in a single list, which can only be searched sequentially
+    inline int getNumSearchThreads() const { return ((config::actor_mcts_think_num_threads <= 1 || config::actor_use_gumbel) ? 1 : config::actor_mcts_think_num_threads); }
+    inline bool useTranspositionTable() const { return transposition_table_ && alphazero_network_; }
     std::vector<MCTS::ActionCandidate> calculateAlphaZeroActionPolicy(const Environment& env_transition, const std::shared_ptr<network::AlphaZeroNetworkOutput>& alphazero_output, const utils::Rotation& rotation);
     std::vector<MCTS::ActionCandidate> calculateMuZeroActionPolicy(MCTSNode* leaf_node, const std::shared_ptr<network::MuZeroNetworkOutput>& muzero_output);
-    virtual Environment getEnvironmentTransition(const std::vector<MCTSNode*>& node_path);
+    virtual const Environment& getEnvironmentTransition(const std::vector<MCTSNode*>& node_path, std::shared_ptr<Environment>& env_transition);
+    const Environment& getEvaluationEnvironment(MCTSEvaluationData& evaluation_data, bool is_prepared);
 
     bool enable_resign_;
     GumbelZero gumbel_zero_;
     uint64_t tree_node_size_;
+    int num_reused_simulation_;
+    std::vector<Action> tree_action_history_;
     MCTSSearchData mcts_search_data_;
+    std::vector<MCTSEvaluationData> evaluations_;
     utils::Rotation feature_rotation_;
+    uint64_t transposition_key_;
+    std::shared_ptr<SearchParalleler> search_paralleler_;
+    std::shared_ptr<TranspositionTable> transposition_table_;
     std::shared_ptr<network::AlphaZeroNetwork> alphazero_network_;
     std::shared_ptr<network::MuZeroNetwork> muzero_network_;
 };
@@ -15,6 +15,11 @@ float actor_mcts_puct_init = 1.25;
 float actor_mcts_reward_discount = 1.0f;
 int actor_mcts_think_batch_size = 1;
 float actor_mcts_think_time_limit = 0;
+int actor_mcts_think_num_threads = 1;
+int actor_mcts_think_env_cache_size = 64;
+std::string actor_mcts_puct_kernel = "auto";
+bool actor_mcts_reuse_tree = false;
+int actor_mcts_transposition_table_size = 0;
 bool actor_mcts_value_rescale = false;
 bool actor_select_action_by_count = false;
 bool actor_select_action_by_softmax_count = true;
@@ -34,6 +39,7 @@ float actor_resign_threshold = -0.9f;
 // zero parameters
 int zero_num_threads = 4;
 int zero_num_parallel_games = 32;
+int zero_num_pipeline_cohorts = 1;
 int zero_server_port = 9999;
 std::string zero_training_directory = "";
 int zero_num_games_per_iteration = 2000;
@@ -60,6 +66,8 @@ float learner_momentum = 0.9;
 float learner_weight_decay = 0.0001;
 float learner_value_loss_scale = 1.0f;
 int learner_num_thread = 8;
+int learner_feature_cache_mb = 4096;
+float learner_tail_interval = 0.0f;
 
 // network parameters
 std::string nn_file_name = "";
@@ -67,6 +75,7 @@ int nn_num_blocks = 1;
 int nn_num_hidden_channels = 256;
 int nn_num_value_hidden_channels = 256;
 std::string nn_type_name = "alphazero";
+int nn_evaluation_cache_size = 0;
 
 // environment parameters
 int env_board_size = 0;
@@ -93,6 +102,16 @@ void setConfiguration(ConfigureLoader& cl)
     cl.addParameter("actor_mcts_value_rescale", actor_mcts_value_rescale, "true for games whose rewards are not bounded in [-1, 1], e.g., Atari games", "Actor");             // ref: MZ
     cl.addParameter("actor_mcts_think_batch_size", actor_mcts_think_batch_size, "the MCTS selection batch size; only works when running console", "Actor");
     cl.addParameter("actor_mcts_think_time_limit", actor_mcts_think_time_limit, "the MCTS time limit in seconds, 0 represents disabling time limit (only uses actor_num_simulation); only works when running console", "Actor");
+    cl.addParameter("actor_mcts_think_num_threads", actor_mcts_think_num_threads, "the number of threads searching the same MCTS tree, which split the selection batch; the batch is enlarged to this number when actor_mcts_think_batch_size is smaller, and gumbel zero always searches with one thread; only works when running console", "Actor");
+    cl.addParameter("actor_mcts_think_env_cache_size", actor_mcts_think_env_cache_size, "the number of leaf environments in the selection batch kept from the network input to the tree update, the others are played again; only works when running console", "Actor");
+    auto puct_kernel_setter = [](std::string& ref, const std::string& value) {
+        if (value != "auto" && value != "avx512" && value != "avx2" && value != "scalar" && value != "node") { return false; }
+        ref = value;
+        return true;
+    };
+    cl.addParameter("actor_mcts_puct_kernel", actor_mcts_puct_kernel, "the kernel for scoring children in PUCT selection: auto (the fastest supported), avx512, avx2, scalar, node (score each node separately); an unsupported avx512 falls back to avx2 and then scalar; all kernels give identical results", "Actor", puct_kernel_setter, getParameter<std::string>);
+    cl.addParameter("actor_mcts_reuse_tree", actor_mcts_reuse_tree, "true for keeping the subtree of the played action as the next search tree; only supports alphazero without gumbel", "Actor");
+    cl.addParameter("actor_mcts_transposition_table_size", actor_mcts_transposition_table_size, "the number of network outputs kept in the transposition table shared by all actors, 0 represents disabling the table; only supports alphazero", "Actor");
     cl.addParameter("actor_select_action_by_count", actor_select_action_by_count, "true for selecting the action by the maximum MCTS count; should not be true together with actor_select_action_by_softmax_count", "Actor");
     cl.addParameter("actor_select_action_by_softmax_count", actor_select_action_by_softmax_count, "true for selecting the action by the propotion of MCTS count; should not be true together with actor_select_action_by_count", "Actor");
     cl.addParameter("actor_select_action_softmax_temperature", actor_select_action_softmax_temperature, "the softmax temperature when using actor_select_action_by_softmax_count", "Actor");
@@ -111,6 +130,7 @@ void setConfiguration(ConfigureLoader& cl)
     // zero parameters
     cl.addParameter("zero_num_threads", zero_num_threads, "the number of threads that the zero server uses for zero training", "Zero");
     cl.addParameter("zero_num_parallel_games", zero_num_parallel_games, "the number of games to be run in parallel for zero training", "Zero");
+    cl.addParameter("zero_num_pipeline_cohorts", zero_num_pipeline_cohorts, "the number of cohorts that the parallel games are split into, so that the tree search of one cohort overlaps the network inference of another; 1 represents alternating all games between the two phases", "Zero");
     cl.addParameter("zero_server_port", zero_server_port, "the port number to host the server; workers should connect to this port number", "Zero");
     cl.addParameter("zero_training_directory", zero_training_directory, "the output directory name for storing training results", "Zero");
     cl.addParameter("zero_num_games_per_iteration", zero_num_games_per_iteration, "the nunmber of games to play in each iteration", "Zero");
@@ -137,6 +157,8 @@ void setConfiguration(ConfigureLoader& cl)
     cl.addParameter("learner_weight_decay", learner_weight_decay, "hyperparameter for weight decay", "Learner");
     cl.addParameter("learner_value_loss_scale", learner_value_loss_scale, "hyperparameter for scaling of the value loss", "Learner");
     cl.addParameter("learner_num_thread", learner_num_thread, "the number of threads for training", "Learner");
+    cl.addParameter("learner_feature_cache_mb", learner_feature_cache_mb, "the memory budget (MB) for caching the features of games in the replay buffer; games beyond the budget are replayed when sampled", "Learner");
+    cl.addParameter("learner_tail_interval", learner_tail_interval, "the interval (seconds) for the learner to load the games of the running self-play iteration; 0 for loading them only before training", "Learner");
 
     // network parameters
     cl.addParameter("nn_file_name", nn_file_name, "the file name of model weights", "Network");
@@ -144,6 +166,7 @@ void setConfiguration(ConfigureLoader& cl)
     cl.addParameter("nn_num_hidden_channels", nn_num_hidden_channels, "hyperparameter for the model; the size of the hidden channels in residual blocks", "Network");               // ref: AGZ
     cl.addParameter("nn_num_value_hidden_channels", nn_num_value_hidden_channels, "hyperparameter for the model; the size of the hidden channels in the value network", "Network"); // ref: AGZ
     cl.addParameter("nn_type_name", nn_type_name, "the type of training algorithm and network: alphazero/muzero", "Network");
+    cl.addParameter("nn_evaluation_cache_size", nn_evaluation_cache_size, "the number of network outputs cached by features and shared by all actors in self-play, 0 represents disabling the cache; only supports alphazero", "Network");
 
     // environment parameters
     cl.addParameter("env_board_size", env_board_size, "the size of board", "Environment");
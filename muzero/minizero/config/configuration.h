@@ -18,6 +18,11 @@ extern float actor_mcts_reward_discount;
 extern bool actor_mcts_value_rescale;
 extern int actor_mcts_think_batch_size;
 extern float actor_mcts_think_time_limit;
+extern int actor_mcts_think_num_threads;
+extern int actor_mcts_think_env_cache_size;
+extern std::string actor_mcts_puct_kernel;
+extern bool actor_mcts_reuse_tree;
+extern int actor_mcts_transposition_table_size;
 extern bool actor_select_action_by_count;
 extern bool actor_select_action_by_softmax_count;
 extern float actor_select_action_softmax_temperature;
@@ -36,6 +41,7 @@ extern float actor_resign_threshold;
 // zero parameters
 extern int zero_num_threads;
 extern int zero_num_parallel_games;
+extern int zero_num_pipeline_cohorts;
 extern int zero_server_port;
 extern std::string zero_training_directory;
 extern int zero_num_games_per_iteration;
@@ -62,6 +68,8 @@ extern float learner_momentum;
 extern float learner_weight_decay;
 extern float learner_value_loss_scale;
 extern int learner_num_thread;
+extern int learner_feature_cache_mb;
+extern float learner_tail_interval;
 
 // network parameters
 extern std::string nn_file_name;
@@ -69,6 +77,7 @@ extern int nn_num_blocks;
 extern int nn_num_hidden_channels;
 extern int nn_num_value_hidden_channels;
 extern std::string nn_type_name;
+extern int nn_evaluation_cache_size;
 
 // environment parameters
 extern int env_board_size;
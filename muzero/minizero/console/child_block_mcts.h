@@ -0,0 +1,213 @@
+#pragma once
+
+#include "configuration.h"
+#include "environment.h"
+#include "mcts.h"
+#include "puct_kernel.h"
+#include "search.h"
+#include <algorithm>
+#include <cassert>
+#include <vector>
+
+namespace minizero::console {
+
+// Benchmark-only prototype used by the tree_benchmark mode; it is not a search backend of ZeroActor.
+// Tree storage in structure-of-arrays layout: a node is an index into the arrays, and the children of
+// a node occupy a contiguous index range, so scanning a child block only touches a few cache lines
+class ChildBlockTree {
+public:
+    ChildBlockTree(uint64_t tree_node_size)
+        : tree_node_size_(tree_node_size),
+          current_node_size_(0)
+    {
+        assert(tree_node_size >= 0);
+    }
+
+    inline void reset()
+    {
+        if (count_.empty()) { resizeNodes(1 + tree_node_size_); }
+        current_node_size_ = 1;
+        resetNodes(0, 1);
+    }
+
+    inline int allocateNodes(int size)
+    {
+        assert(current_node_size_ + size <= tree_node_size_);
+        int index = current_node_size_;
+        current_node_size_ += size;
+        resetNodes(index, size);
+        return index;
+    }
+
+    inline void add(int node, float value, float weight = 1.0f)
+    {
+        if (count_[node] + weight <= 0) {
+            resetNodes(node, 1);
+        } else {
+            count_[node] += weight;
+            mean_[node] += weight * (value - mean_[node]) / count_[node];
+        }
+    }
+
+    inline bool isLeaf(int node) const { return (num_children_[node] == 0); }
+    inline void setAction(int node, Action action) { action_[node] = action; }
+    inline void setChildren(int node, int first_child, int num_children)
+    {
+        first_child_[node] = first_child;
+        num_children_[node] = num_children;
+    }
+    inline void setCount(int node, float count) { count_[node] = count; }
+    inline void setMean(int node, float mean) { mean_[node] = mean; }
+    inline void setPolicy(int node, float policy) { policy_[node] = policy; }
+    inline void addVirtualLoss(int node, float num = 1.0f) { virtual_loss_[node] += num; }
+    inline void removeVirtualLoss(int node, float num = 1.0f) { virtual_loss_[node] -= num; }
+
+    inline int getRootNode() const { return 0; }
+    inline const Action& getAction(int node) const { return action_[node]; }
+    inline int getFirstChild(int node) const { return first_child_[node]; }
+    inline int getNumChildren(int node) const { return num_children_[node]; }
+    inline float getCount(int node) const { return count_[node]; }
+    inline float getMean(int node) const { return mean_[node]; }
+    inline float getPolicy(int node) const { return policy_[node]; }
+    inline float getVirtualLoss(int node) const { return virtual_loss_[node]; }
+    inline float getCountWithVirtualLoss(int node) const { return count_[node] + virtual_loss_[node]; }
+
+protected:
+    virtual void resizeNodes(uint64_t size)
+    {
+        action_.resize(size);
+        first_child_.resize(size);
+        num_children_.resize(size);
+        count_.resize(size);
+        mean_.resize(size);
+        policy_.resize(size);
+        virtual_loss_.resize(size);
+    }
+
+    virtual void resetNodes(int index, int size)
+    {
+        std::fill(first_child_.begin() + index, first_child_.begin() + index + size, 0);
+        std::fill(num_children_.begin() + index, num_children_.begin() + index + size, 0);
+        std::fill(count_.begin() + index, count_.begin() + index + size, 0.0f);
+        std::fill(mean_.begin() + index, mean_.begin() + index + size, 0.0f);
+        std::fill(policy_.begin() + index, policy_.begin() + index + size, 0.0f);
+        std::fill(virtual_loss_.begin() + index, virtual_loss_.begin() + index + size, 0.0f);
+    }
+
+    uint64_t tree_node_size_;
+    uint64_t current_node_size_;
+    std::vector<Action> action_;
+    std::vector<int> first_child_;
+    std::vector<int> num_children_;
+    std::vector<float> count_;
+    std::vector<float> mean_;
+    std::vector<float> policy_;
+    std::vector<float> virtual_loss_;
+};
+
+// the same PUCT search as MCTS on top of the structure-of-arrays ChildBlockTree, only for comparing the selection throughput;
+// unlike MCTS it is not thread-safe (plain statistics and a shared score buffer), so it must be searched by a single thread
+class ChildBlockMCTS : public ChildBlockTree, public actor::Search {
+public:
+    ChildBlockMCTS(uint64_t tree_node_size)
+        : ChildBlockTree(tree_node_size) {}
+
+    void reset() override
+    {
+        ChildBlockTree::reset();
+        tree_value_bound_.reset(config::actor_num_simulation + 1);
+    }
+
+    virtual std::vector<int> select() { return selectFromNode(getRootNode()); }
+
+    virtual std::vector<int> selectFromNode(int start_node)
+    {
+        int node = start_node;
+        std::vector<int> node_path{node};
+        while (!isLeaf(node)) {
+            node = selectChildByPUCTScore(node);
+            node_path.push_back(node);
+        }
+        return node_path;
+    }
+
+    virtual void expand(int leaf_node, const std::vector<actor::MCTS::ActionCandidate>& action_candidates)
+    {
+        assert(action_candidates.size() > 0);
+        int first_child = allocateNodes(action_candidates.size());
+        setChildren(leaf_node, first_child, action_candidates.size());
+        for (size_t i = 0; i < action_candidates.size(); ++i) {
+            setAction(first_child + i, action_candidates[i].action_);
+            setPolicy(first_child + i, action_candidates[i].policy_);
+        }
+    }
+
+    virtual void backup(const std::vector<int>& node_path, const float value, const float reward = 0.0f)
+    {
+        assert(node_path.size() > 0);
+        float updated_value = value;
+        reward_[node_path.back()] = reward;
+        for (int i = static_cast<int>(node_path.size() - 1); i >= 0; --i) {
+            int node = node_path[i];
+            float old_mean = reward_[node] + config::actor_mcts_reward_discount * getMean(node);
+            add(node, updated_value);
+            updateTreeValueBound(old_mean, reward_[node] + config::actor_mcts_reward_discount * getMean(node));
+            updated_value = reward_[node] + config::actor_mcts_reward_discount * updated_value;
+        }
+    }
+
+    // the child block is already contiguous, so the arrays are passed to the kernel directly
+    virtual int selectChildByPUCTScore(int node) const
+    {
+        assert(!isLeaf(node));
+        actor::PUCTKernelType type = (actor::PUCTKernel::getType() == actor::PUCTKernelType::kNode ? actor::PUCTKernelType::kScalar : actor::PUCTKernel::getType());
+        const int first_child = getFirstChild(node);
+        const int num_children = getNumChildren(node);
+        if (static_cast<int>(scores_.size()) < num_children) { scores_.resize(num_children); }
+        actor::PUCTKernel::ChildBlock block{num_children,
+                                     count_.data() + first_child,
+                                     virtual_loss_.data() + first_child,
+                                     mean_.data() + first_child,
+                                     reward_.data() + first_child,
+                                     policy_.data() + first_child};
+        return first_child + actor::PUCTKernel::selectChild(type, getPUCTParentTerms(node), block, scores_.data());
+    }
+
+    actor::PUCTKernel::ParentTerms getPUCTParentTerms(int node) const
+    {
+        const bool is_player1 = (getAction(getFirstChild(node)).getPlayer() == env::Player::kPlayer1);
+        const float value_lower_bound = (tree_value_bound_.empty() ? 0.0f : tree_value_bound_.getLowerBound());
+        const float value_upper_bound = (tree_value_bound_.empty() ? 0.0f : tree_value_bound_.getUpperBound());
+        return actor::PUCTKernel::calculateParentTerms(getCountWithVirtualLoss(node) - 1, is_player1, tree_value_bound_.size(), value_lower_bound, value_upper_bound);
+    }
+
+    inline float getReward(int node) const { return reward_[node]; }
+    inline void setReward(int node, float reward) { reward_[node] = reward; }
+    inline actor::TreeValueBound& getTreeValueBound() { return tree_value_bound_; }
+    inline const actor::TreeValueBound& getTreeValueBound() const { return tree_value_bound_; }
+
+protected:
+    void resizeNodes(uint64_t size) override
+    {
+        ChildBlockTree::resizeNodes(size);
+        reward_.resize(size);
+    }
+
+    void resetNodes(int index, int size) override
+    {
+        ChildBlockTree::resetNodes(index, size);
+        std::fill(reward_.begin() + index, reward_.begin() + index + size, 0.0f);
+    }
+
+    virtual void updateTreeValueBound(float old_value, float new_value)
+    {
+        if (!config::actor_mcts_value_rescale) { return; }
+        tree_value_bound_.update(old_value, new_value);
+    }
+
+    std::vector<float> reward_;
+    mutable std::vector<float> scores_;
+    actor::TreeValueBound tree_value_bound_;
+};
+
+} // namespace minizero::console
@@ -232,7 +232,7 @@ void Console::calculatePolicyValue(std::vector<float>& policy, float& value, uti
         int index = muzero_network->pushBackInitialData(actor_->getEnvironment().getFeatures());
         std::shared_ptr<NetworkOutput> network_output = muzero_network->initialInference()[index];
         std::shared_ptr<minizero::network::MuZeroNetworkOutput> zero_output = std::static_pointer_cast<minizero::network::MuZeroNetworkOutput>(network_output);
-        policy = zero_output->policy_;
+        policy = zero_output->policy_.toVector();
         value = zero_output->value_;
     } else {
         assert(false); // should not be here
@@ -1,11 +1,20 @@
 #include "mode_handler.h"
 #include "actor_group.h"
+#include "child_block_mcts.h"
 #include "console.h"
 #include "git_info.h"
+#include "mcts.h"
 #include "ostream_redirector.h"
 #include "random.h"
+#include "record_file.h"
+#include "time_system.h"
+#include "zero_actor.h"
 #include "zero_server.h"
+#include <cstring>
+#include <functional>
+#include <numeric>
 #include <string>
+#include <thread>
 #include <vector>
 
 namespace minizero::console {
@@ -19,6 +28,11 @@ ModeHandler::ModeHandler()
     RegisterFunction("zero_server", this, &ModeHandler::runZeroServer);
     RegisterFunction("zero_training_name", this, &ModeHandler::runZeroTrainingName);
     RegisterFunction("env_test", this, &ModeHandler::runEnvTest);
+    RegisterFunction("tree_value_bound_test", this, &ModeHandler::runTreeValueBoundTest);
+    RegisterFunction("tree_benchmark", this, &ModeHandler::runTreeBenchmark);
+    RegisterFunction("search_benchmark", this, &ModeHandler::runSearchBenchmark);
+    RegisterFunction("env_benchmark", this, &ModeHandler::runEnvBenchmark);
+    RegisterFunction("sgf_to_binary", this, &ModeHandler::runSGFToBinary);
 }
 
 void ModeHandler::run(int argc, char* argv[])
@@ -174,4 +188,289 @@ void ModeHandler::runEnvTest()
     std::cout << env_loader.toString() << std::endl;
 }
 
+void ModeHandler::runTreeValueBoundTest()
+{
+    // replay random updates on actor::TreeValueBound and on the std::map<float, int> it replaced, and compare them after every update;
+    // the values are drawn from a small pool so that they repeat, and the pool contains both 0.0f and -0.0f, which compare equal
+    auto is_same_value = [](float lhs, float rhs) { return memcmp(&lhs, &rhs, sizeof(float)) == 0; };
+    const int num_sequences = 1000;
+    const int num_updates = 200;
+    int num_mismatch = 0;
+    for (int sequence = 0; sequence < num_sequences; ++sequence) {
+        std::vector<float> pool{0.0f, -0.0f, 1.0f, -1.0f};
+        const int pool_size = 1 + utils::Random::randInt() % 16;
+        for (int i = 0; i < pool_size; ++i) { pool.push_back(utils::Random::randReal(4) - 2); }
+
+        actor::TreeValueBound tree_value_bound;
+        std::map<float, int> reference;
+        tree_value_bound.reset(num_updates);
+        for (int update = 0; update < num_updates; ++update) {
+            float old_value = pool[utils::Random::randInt() % pool.size()];
+            float new_value = pool[utils::Random::randInt() % pool.size()];
+            tree_value_bound.update(old_value, new_value);
+            if (reference.count(old_value)) {
+                if (--reference[old_value] == 0) { reference.erase(old_value); }
+            }
+            ++reference[new_value];
+
+            if (tree_value_bound.size() != static_cast<int>(reference.size())
+                || (!reference.empty() && (!is_same_value(tree_value_bound.getLowerBound(), reference.begin()->first) || !is_same_value(tree_value_bound.getUpperBound(), reference.rbegin()->first)))) {
+                ++num_mismatch;
+            }
+        }
+    }
+    std::cout << "sequences: " << num_sequences << ", updates: " << num_updates << ", mismatched updates: " << num_mismatch << std::endl;
+    if (num_mismatch > 0) { exit(1); }
+}
+
+void ModeHandler::runTreeBenchmark()
+{
+    class BenchmarkMCTS : public actor::MCTS {
+    public:
+        BenchmarkMCTS(uint64_t tree_node_size) : MCTS(tree_node_size) {}
+        using MCTS::calculateInitQValue;
+        using MCTS::gatherChildBlock;
+        using MCTS::getPUCTParentTerms;
+        using MCTS::selectChildByPUCTKernel;
+        using MCTS::selectChildByPUCTScore;
+    };
+
+    // compare the PUCT selection throughput of MCTSNode and ChildBlockTree on the number of legal actions of an empty 9x9 and 19x19 Go board;
+    // many parent nodes are scanned in turn so that the children do not stay in cache
+    const int num_parents = 1024;
+    const int num_rounds = 20;
+    bool identical = true;
+    for (int num_children : {9 * 9 + 1, 19 * 19 + 1}) {
+        BenchmarkMCTS mcts(1 + num_parents * (num_children + 1));
+        ChildBlockMCTS child_block_mcts(1 + num_parents * (num_children + 1));
+        mcts.reset();
+        child_block_mcts.reset();
+
+        std::vector<actor::MCTS::ActionCandidate> parent_candidates;
+        for (int i = 0; i < num_parents; ++i) { parent_candidates.emplace_back(Action(i, env::Player::kPlayer1), 1.0f / num_parents, 0.0f); }
+        mcts.expand(mcts.getRootNode(), parent_candidates);
+        child_block_mcts.expand(child_block_mcts.getRootNode(), parent_candidates);
+
+        std::vector<actor::MCTSNode*> parents;
+        std::vector<int> child_block_parents;
+        for (int i = 0; i < num_parents; ++i) {
+            actor::MCTSNode* parent = mcts.getRootNode()->getChild(i);
+            int child_block_parent = child_block_mcts.getFirstChild(child_block_mcts.getRootNode()) + i;
+            std::vector<float> policy(num_children);
+            for (auto& p : policy) { p = utils::Random::randReal(); }
+            float policy_sum = std::accumulate(policy.begin(), policy.end(), 0.0f);
+            std::vector<actor::MCTS::ActionCandidate> candidates;
+            for (int action_id = 0; action_id < num_children; ++action_id) { candidates.emplace_back(Action(action_id, env::Player::kPlayer2), policy[action_id] / policy_sum, 0.0f); }
+            mcts.expand(parent, candidates);
+            child_block_mcts.expand(child_block_parent, candidates);
+
+            // visit some of the children, some of which are still being evaluated
+            float total_count = 1;
+            for (int child_id = 0; child_id < num_children; ++child_id) {
+                if (utils::Random::randInt() % 4 != 0) { continue; }
+                actor::MCTSNode* child = parent->getChild(child_id);
+                int child_block_child = child_block_mcts.getFirstChild(child_block_parent) + child_id;
+                float count = utils::Random::randInt() % 32;
+                float mean = utils::Random::randReal(2) - 1;
+                float reward = (utils::Random::randInt() % 2 == 0 ? 0.0f : utils::Random::randReal(2) - 1);
+                float virtual_loss = utils::Random::randInt() % 3;
+                child->setCount(count);
+                child->setMean(mean);
+                child->setReward(reward);
+                child->addVirtualLoss(virtual_loss);
+                child_block_mcts.setCount(child_block_child, count);
+                child_block_mcts.setMean(child_block_child, mean);
+                child_block_mcts.setReward(child_block_child, reward);
+                child_block_mcts.addVirtualLoss(child_block_child, virtual_loss);
+                total_count += count + virtual_loss;
+            }
+            parent->setCount(total_count);
+            child_block_mcts.setCount(child_block_parent, total_count);
+            parents.push_back(parent);
+            child_block_parents.push_back(child_block_parent);
+        }
+        for (int i = 0; i < 16; ++i) {
+            float value = utils::Random::randReal(4) - 2;
+            mcts.getTreeValueBound().update(value, value);
+            child_block_mcts.getTreeValueBound().update(value, value);
+        }
+
+        // all kernels should give bit-identical scores to MCTSNode::getNormalizedPUCTScore, with and without value rescaling
+        std::vector<actor::PUCTKernelType> kernel_types;
+        for (auto type : {actor::PUCTKernelType::kScalar, actor::PUCTKernelType::kAVX2, actor::PUCTKernelType::kAVX512}) {
+            if (actor::PUCTKernel::isSupported(type)) { kernel_types.push_back(type); }
+        }
+        const bool value_rescale = config::actor_mcts_value_rescale;
+        for (bool rescale : {false, true}) {
+            config::actor_mcts_value_rescale = rescale;
+            for (auto type : kernel_types) {
+                int num_mismatch = 0;
+                std::vector<float> buffer;
+                for (auto parent : parents) {
+                    actor::PUCTKernel::ChildBlock block = mcts.gatherChildBlock(parent, buffer);
+                    float* scores = buffer.data() + 5 * block.size_;
+                    actor::PUCTKernel::calculateScores(type, mcts.getPUCTParentTerms(parent), block, scores);
+                    int total_simulation = parent->getCountWithVirtualLoss() - 1;
+                    float init_q_value = mcts.calculateInitQValue(parent);
+                    for (int i = 0; i < num_children; ++i) {
+                        float score = parent->getChild(i)->getNormalizedPUCTScore(total_simulation, mcts.getTreeValueBound(), init_q_value);
+                        if (memcmp(&score, &scores[i], sizeof(float)) != 0) { ++num_mismatch; }
+                    }
+                }
+                std::cout << "children: " << num_children << ", value rescale: " << (rescale ? "true" : "false")
+                          << ", kernel: " << actor::PUCTKernel::getTypeName(type)
+                          << ", mismatched scores: " << num_mismatch << std::endl;
+                if (num_mismatch > 0) { identical = false; }
+            }
+        }
+        config::actor_mcts_value_rescale = value_rescale;
+
+        // throughput
+        auto benchmark = [&](const std::string& name, const std::function<int(int)>& select) {
+            std::vector<int> selected(num_parents);
+            boost::posix_time::ptime start_time = utils::TimeSystem::getLocalTime();
+            for (int round = 0; round < num_rounds; ++round) {
+                for (int i = 0; i < num_parents; ++i) { selected[i] = select(i); }
+            }
+            double seconds = (utils::TimeSystem::getLocalTime() - start_time).total_microseconds() / 1e6;
+            std::cout << "children: " << num_children << ", " << name << ": "
+                      << static_cast<double>(num_rounds) * num_parents * num_children / seconds / 1e6 << "M children/s" << std::endl;
+            return selected;
+        };
+        std::vector<int> selected = benchmark("MCTSNode", [&](int i) {
+            return mcts.selectChildByPUCTKernel(parents[i], actor::PUCTKernelType::kNode) - parents[i]->getChild(0);
+        });
+        for (auto type : kernel_types) {
+            std::vector<int> kernel_selected = benchmark("MCTSNode with " + actor::PUCTKernel::getTypeName(type) + " kernel", [&](int i) {
+                return mcts.selectChildByPUCTKernel(parents[i], type) - parents[i]->getChild(0);
+            });
+            if (kernel_selected != selected) {
+                std::cout << "different selection with " << actor::PUCTKernel::getTypeName(type) << " kernel" << std::endl;
+                identical = false;
+            }
+        }
+        actor::PUCTKernelType child_block_type = (actor::PUCTKernel::getType() == actor::PUCTKernelType::kNode ? actor::PUCTKernelType::kScalar : actor::PUCTKernel::getType());
+        std::vector<int> child_block_selected = benchmark("ChildBlockTree with " + actor::PUCTKernel::getTypeName(child_block_type) + " kernel", [&](int i) {
+            return child_block_mcts.selectChildByPUCTScore(child_block_parents[i]) - child_block_mcts.getFirstChild(child_block_parents[i]);
+        });
+        if (child_block_selected != selected) {
+            std::cout << "different selection with ChildBlockTree" << std::endl;
+            identical = false;
+        }
+    }
+    if (!identical) {
+        std::cout << "the PUCT kernels are not bit-identical to MCTSNode::getNormalizedPUCTScore" << std::endl;
+        exit(1);
+    }
+}
+
+void ModeHandler::runSearchBenchmark()
+{
+    // measure the per-move latency of one MCTS tree searched by 1, 2, 4, ... threads (up to the number of cores or actor_mcts_think_num_threads)
+    // in the same way as ZeroActor::step; the network is replaced by a uniform policy and a zero value, so only the tree and the leaf environments are measured
+    const int num_moves = 20;
+    const int max_num_threads = std::max({1, static_cast<int>(std::thread::hardware_concurrency()), config::actor_mcts_think_num_threads});
+    const uint64_t tree_node_size = static_cast<uint64_t>(config::actor_num_simulation + 1) * Environment().getPolicySize();
+    bool consistent = true;
+    double single_thread_latency = 0.0;
+    for (int num_threads = 1; num_threads <= max_num_threads; num_threads *= 2) {
+        actor::MCTS mcts(tree_node_size);
+        std::shared_ptr<actor::SearchParalleler> search_paralleler = (num_threads > 1 ? std::make_shared<actor::SearchParalleler>(num_threads) : nullptr);
+        auto run_jobs = [&](int num_jobs, const std::function<void(int)>& job) {
+            if (!search_paralleler) {
+                for (int job_id = 0; job_id < num_jobs; ++job_id) { job(job_id); }
+            } else {
+                search_paralleler->runJobs(num_jobs, job);
+            }
+        };
+
+        Environment env;
+        env.reset();
+        std::vector<actor::MCTSEvaluationData> evaluations(std::max(config::actor_mcts_think_batch_size, num_threads));
+        boost::posix_time::ptime start_time = utils::TimeSystem::getLocalTime();
+        for (int move = 0; move < num_moves; ++move) {
+            mcts.reset();
+            while (!mcts.reachMaximumSimulation()) {
+                const int batch_size = std::min(static_cast<int>(evaluations.size()), config::actor_num_simulation + 1 - mcts.getNumSimulation());
+                run_jobs(batch_size, [&](int batch_id) {
+                    actor::MCTSEvaluationData& evaluation = evaluations[batch_id];
+                    evaluation.node_path_ = mcts.select();
+                    evaluation.need_evaluation_ = (evaluation.node_path_.back()->addVirtualLoss() == 0);
+                    for (size_t i = 0; i < evaluation.node_path_.size() - 1; ++i) { evaluation.node_path_[i]->addVirtualLoss(); }
+                    if (!evaluation.need_evaluation_) { return; }
+                    if (!evaluation.env_transition_) { evaluation.env_transition_ = std::make_shared<Environment>(); }
+                    *evaluation.env_transition_ = env;
+                    for (size_t i = 1; i < evaluation.node_path_.size(); ++i) { evaluation.env_transition_->act(evaluation.node_path_[i]->getAction()); }
+                    evaluation.env_transition_->getFeatures();
+                });
+                run_jobs(batch_size, [&](int batch_id) {
+                    actor::MCTSEvaluationData& evaluation = evaluations[batch_id];
+                    if (!evaluation.need_evaluation_) { return; }
+                    const std::vector<actor::MCTSNode*>& node_path = evaluation.node_path_;
+                    const Environment& env_transition = *evaluation.env_transition_;
+                    if (env_transition.isTerminal()) {
+                        mcts.backup(node_path, env_transition.getEvalScore(), env_transition.getReward());
+                    } else {
+                        std::vector<actor::MCTS::ActionCandidate> candidates;
+                        std::vector<Action> legal_actions = env_transition.getLegalActions();
+                        for (const auto& action : legal_actions) { candidates.emplace_back(action, 1.0f / legal_actions.size(), 0.0f); }
+                        mcts.expand(node_path.back(), candidates);
+                        mcts.backup(node_path, 0.0f, env_transition.getReward());
+                    }
+                    float virtual_loss = node_path.back()->getVirtualLoss();
+                    for (auto node : node_path) { node->removeVirtualLoss(virtual_loss); }
+                });
+            }
+
+            // every simulation is backed up exactly once, and no virtual loss is left behind
+            if (mcts.getNumSimulation() != config::actor_num_simulation + 1 || mcts.getRootNode()->getVirtualLoss() != 0.0f) { consistent = false; }
+            env.act(mcts.selectChildByMaxCount(mcts.getRootNode())->getAction());
+            if (env.isTerminal()) { env.reset(); }
+        }
+        double latency = (utils::TimeSystem::getLocalTime() - start_time).total_microseconds() / 1e3 / num_moves;
+        if (num_threads == 1) { single_thread_latency = latency; }
+        std::cout << "threads: " << num_threads << ", batch size: " << evaluations.size()
+                  << ", simulations: " << config::actor_num_simulation << ", latency: " << latency << " ms/move"
+                  << ", speedup: " << single_thread_latency / latency << std::endl;
+    }
+    if (!consistent) {
+        std::cout << "inconsistent tree statistics after a multi-threaded search" << std::endl;
+        exit(1);
+    }
+}
+
+void ModeHandler::runEnvBenchmark()
+{
+    // play random games and measure the throughput of act() together with getLegalActions(), which dominate the cost of an mcts simulation in the environment
+    const int num_games = 1000;
+    int64_t num_actions = 0;
+    boost::posix_time::ptime start_time = utils::TimeSystem::getLocalTime();
+    for (int game = 0; game < num_games; ++game) {
+        Environment env;
+        env.reset();
+        while (!env.isTerminal()) {
+            std::vector<Action> legal_actions = env.getLegalActions();
+            int index = utils::Random::randInt() % legal_actions.size();
+            env.act(legal_actions[index]);
+            ++num_actions;
+        }
+    }
+    double seconds = (utils::TimeSystem::getLocalTime() - start_time).total_microseconds() / 1e6;
+    std::cout << "games: " << num_games << ", actions: " << num_actions << ", seconds: " << seconds
+              << ", " << num_actions / seconds << " actions/s" << std::endl;
+}
+
+void ModeHandler::runSGFToBinary()
+{
+    // converts the records of an sgf file (one game per line) from stdin into a record file on stdout
+    RecordFileWriter writer(std::cout);
+    EnvironmentLoader env_loader;
+    for (std::string content; std::getline(std::cin, content);) {
+        if (content.empty() || !env_loader.loadFromString(content)) { continue; }
+        writer.write(env_loader.toBinary());
+    }
+    writer.close();
+    std::cerr << "converted " << writer.getNumRecords() << " records" << std::endl;
+}
+
 } // namespace minizero::console
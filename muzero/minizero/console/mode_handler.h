@@ -47,6 +47,11 @@ protected:
     virtual void runZeroServer();
     virtual void runZeroTrainingName();
     virtual void runEnvTest();
+    virtual void runTreeValueBoundTest();
+    virtual void runTreeBenchmark();
+    virtual void runSearchBenchmark();
+    virtual void runEnvBenchmark();
+    virtual void runSGFToBinary();
 
     std::map<std::string, std::shared_ptr<BaseFunction>> function_map_;
 };
@@ -1,4 +1,5 @@
 #include "atari.h"
+#include <algorithm>
 #include <opencv2/opencv.hpp>
 #include <utility>
 
@@ -148,6 +149,13 @@ bool AtariEnvLoader::loadFromString(const std::string& content)
     return success;
 }
 
+bool AtariEnvLoader::loadFromBinary(const char* data, size_t size)
+{
+    bool success = BaseEnvLoader::loadFromBinary(data, size);
+    addObservations(getTag("OBS"));
+    return success;
+}
+
 void AtariEnvLoader::loadFromEnvironment(const AtariEnv& env, const std::vector<std::vector<std::pair<std::string, std::string>>>& action_info_history /* = {} */)
 {
     BaseEnvLoader::loadFromEnvironment(env, action_info_history);
@@ -155,7 +163,7 @@ void AtariEnvLoader::loadFromEnvironment(const AtariEnv& env, const std::vector<
     int previous_lives = env.getLivesHistory()[0];
     for (size_t i = 0; i < action_pairs_.size(); ++i) {
         int lives = env.getLivesHistory()[i];
-        if (lives < previous_lives) { action_pairs_[i].second["L"] = std::to_string(lives); }
+        if (lives < previous_lives) { setActionPairInfo(i, "L", std::to_string(lives)); }
         previous_lives = lives;
     }
 }
@@ -230,9 +238,10 @@ float AtariEnvLoader::calculateNStepValue(const int pos) const
     const float discount = config::actor_mcts_reward_discount;
     size_t bootstrap_index = pos + n_step;
     float value = 0.0f;
-    float n_step_value = ((bootstrap_index < action_pairs_.size() && !action_pairs_[bootstrap_index].second.count("L")) ? std::pow(discount, n_step) * BaseEnvLoader::getValue(bootstrap_index)[0] : 0.0f);
+    float n_step_value = ((bootstrap_index < action_pairs_.size() && action_pairs_[bootstrap_index].second.getOtherInfo("L").empty()) ? std::pow(discount, n_step) * BaseEnvLoader::getValue(bootstrap_index)[0] : 0.0f);
     for (size_t index = pos; index < std::min(bootstrap_index, action_pairs_.size()); ++index) {
-        if (action_pairs_[index].second.count("L") && std::stoi(action_pairs_[index].second.at("L")) > 0) { return value; }
+        const std::string& lives = action_pairs_[index].second.getOtherInfo("L");
+        if (!lives.empty() && std::stoi(lives) > 0) { return value; }
         float reward = BaseEnvLoader::getReward(index)[0];
         value += std::pow(discount, index - pos) * reward;
     }
@@ -242,7 +251,14 @@ float AtariEnvLoader::calculateNStepValue(const int pos) const
 
 std::vector<float> AtariEnvLoader::toDiscreteValue(float value) const
 {
-    std::vector<float> discrete_value(kAtariDiscreteValueSize, 0.0f);
+    std::vector<float> discrete_value(kAtariDiscreteValueSize);
+    toDiscreteValue(value, discrete_value.data());
+    return discrete_value;
+}
+
+void AtariEnvLoader::toDiscreteValue(float value, float* discrete_value) const
+{
+    std::fill(discrete_value, discrete_value + kAtariDiscreteValueSize, 0.0f);
     int value_floor = floor(value);
     int value_ceil = ceil(value);
     int shift = kAtariDiscreteValueSize / 2;
@@ -254,7 +270,6 @@ std::vector<float> AtariEnvLoader::toDiscreteValue(float value) const
         discrete_value[value_floor_shift] = value_ceil - value;
         discrete_value[value_ceil_shift] = value - value_floor;
     }
-    return discrete_value;
 }
 
 } // namespace minizero::env::atari
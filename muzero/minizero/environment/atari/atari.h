@@ -98,11 +98,16 @@ class AtariEnvLoader : public BaseEnvLoader<AtariAction, AtariEnv> {
 public:
     void reset() override;
     bool loadFromString(const std::string& content) override;
+    bool loadFromBinary(const char* data, size_t size) override;
     void loadFromEnvironment(const AtariEnv& env, const std::vector<std::vector<std::pair<std::string, std::string>>>& action_info_history = {}) override;
     std::vector<float> getFeatures(const int pos, utils::Rotation rotation = utils::Rotation::kRotationNone) const override;
+    std::vector<float> getFeaturesByReplay(const int pos, utils::Rotation rotation = utils::Rotation::kRotationNone) const override;
     std::vector<float> getActionFeatures(const int pos, utils::Rotation rotation = utils::Rotation::kRotationNone) const override;
+    inline void cacheFeatures(int begin, int end) override {} // the features are built from the recorded observations without replaying
     std::vector<float> getValue(const int pos) const override { return toDiscreteValue(pos < static_cast<int>(action_pairs_.size()) ? utils::transformValue(calculateNStepValue(pos)) : 0.0f); }
     inline std::vector<float> getReward(const int pos) const override { return toDiscreteValue(pos < static_cast<int>(action_pairs_.size()) ? utils::transformValue(BaseEnvLoader::getReward(pos)[0]) : 0.0f); }
+    void writeValue(const int pos, float* value) const override { toDiscreteValue(pos < static_cast<int>(action_pairs_.size()) ? utils::transformValue(calculateNStepValue(pos)) : 0.0f, value); }
+    void writeReward(const int pos, float* reward) const override { toDiscreteValue(pos < static_cast<int>(action_pairs_.size()) ? utils::transformValue(BaseEnvLoader::getReward(pos)[0]) : 0.0f, reward); }
     float getPriority(const int pos) const override { return fabs(calculateNStepValue(pos) - BaseEnvLoader::getValue(pos)[0]) + 1e-6; }
 
     inline std::string name() const override { return kAtariName + "_" + minizero::config::env_atari_name; }
@@ -112,9 +117,9 @@ public:
 
 private:
     void addObservations(const std::string& compressed_obs);
-    std::vector<float> getFeaturesByReplay(const int pos, utils::Rotation rotation = utils::Rotation::kRotationNone) const;
     float calculateNStepValue(const int pos) const;
     std::vector<float> toDiscreteValue(float value) const;
+    void toDiscreteValue(float value, float* discrete_value) const;
 
     std::vector<std::string> observations_;
 };
@@ -1,12 +1,19 @@
 #pragma once
 
+#include "arena_allocator.h"
 #include "configuration.h"
+#include "record_file.h"
 #include "rotation.h"
 #include "sgf_loader.h"
 #include "utils.h"
 #include "vector_map.h"
 #include <algorithm>
 #include <cassert>
+#include <cctype>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
 #include <fstream>
 #include <memory>
 #include <sstream>
@@ -85,6 +92,12 @@ public:
     virtual float getReward() const = 0;
     virtual float getEvalScore(bool is_resign = false) const = 0;
     virtual std::vector<float> getFeatures(utils::Rotation rotation = utils::Rotation::kRotationNone) const = 0;
+    // writes the features to the given buffer, e.g., an input row of the network; the default copies getFeatures()
+    virtual void writeFeatures(float* features, utils::Rotation rotation = utils::Rotation::kRotationNone) const
+    {
+        const std::vector<float> env_features = getFeatures(rotation);
+        std::copy(env_features.begin(), env_features.end(), features);
+    }
     virtual std::vector<float> getActionFeatures(const Action& action, utils::Rotation rotation = utils::Rotation::kRotationNone) const = 0;
     virtual int getNumInputChannels() const = 0;
     virtual int getNumActionFeatureChannels() const = 0;
@@ -101,6 +114,10 @@ public:
     virtual int getNumPlayer() const = 0;
     virtual void setTurn(Player p) { turn_ = p; }
 
+    // identifies the state that the network features are built from, i.e., states with the same key share the same network output
+    // the default hashes the features themselves; environments with an incremental hash should override it
+    virtual uint64_t getTranspositionKey() const { return utils::hashFeatures(getFeatures()); }
+
     inline Player getTurn() const { return turn_; }
     inline const std::vector<Action>& getActionHistory() const { return actions_; }
     inline const std::vector<std::string>& getObservationHistory() const { return observations_; }
@@ -114,11 +131,43 @@ protected:
 template <class Action, class Env>
 class BaseEnvLoader {
 public:
-    BaseEnvLoader() {}
+    BaseEnvLoader() : keep_sgf_content_(false), feature_cache_begin_(0), feature_cache_end_(0) {}
+    BaseEnvLoader(const BaseEnvLoader&) = default;
+    BaseEnvLoader(BaseEnvLoader&&) = default; // the declared destructor would otherwise turn every move into a copy
+    BaseEnvLoader& operator=(const BaseEnvLoader&) = default;
+    BaseEnvLoader& operator=(BaseEnvLoader&&) = default;
     virtual ~BaseEnvLoader() = default;
 
     typedef minizero::utils::VectorMap<std::string, std::string> Tags;
-    typedef minizero::utils::VectorMap<std::string, std::string> ActionInfo;
+
+    // the info recorded with a move, where "P", "V" and "R" are kept typed and only rare keys such as "L" are kept as strings
+    // the sparse policy is the range [policy_begin_, policy_begin_ + policy_size_) of the loader's policy arena
+    class ActionInfo {
+    public:
+        enum Flag : uint8_t {
+            kHasValue = 1,
+            kHasReward = 2
+        };
+
+        ActionInfo() : value_(0.0f), reward_(0.0f), policy_begin_(0), policy_size_(0), flags_(0) {}
+
+        inline const std::string& getOtherInfo(const std::string& key) const
+        {
+            static const std::string empty;
+            for (const auto& info : other_info_) {
+                if (info.first == key) { return info.second; }
+            }
+            return empty;
+        }
+
+        float value_;
+        float reward_;
+        uint32_t policy_begin_;
+        uint16_t policy_size_;
+        uint8_t flags_;
+        std::vector<std::pair<std::string, std::string>> other_info_;
+    };
+    typedef std::vector<std::pair<Action, ActionInfo>, utils::ArenaAllocator<std::pair<Action, ActionInfo>>> ActionPairs;
 
 public:
     virtual void reset()
@@ -128,6 +177,9 @@ public:
         tags_.insert({"GM", name()});
         tags_.insert({"RE", "0"});
         action_pairs_.clear();
+        policy_ids_.clear();
+        policy_counts_.clear();
+        clearFeatureCache();
     }
 
     virtual bool loadFromFile(const std::string& file_name)
@@ -148,7 +200,8 @@ public:
     virtual bool loadFromString(const std::string& content)
     {
         reset();
-        sgf_content_ = content;
+        if (keep_sgf_content_) { sgf_content_ = content; }
+        reserveActionPairs(content);
         std::string key, value;
         int state = '(';
         bool accept_move = false;
@@ -185,7 +238,7 @@ public:
                             action_pairs_.emplace_back().first = Action(action_id, charToPlayer(key[0]));
                             accept_move = false;
                         } else if (action_pairs_.size()) {
-                            action_pairs_.back().second[key] = std::move(value);
+                            setActionInfo(action_pairs_.back().second, key, value);
                         } else {
                             if (key == "SZ") { board_size = std::stoi(value); }
                             tags_[key] = std::move(value);
@@ -205,8 +258,9 @@ public:
     virtual void loadFromEnvironment(const Env& env, const std::vector<std::vector<std::pair<std::string, std::string>>>& action_info_history = {})
     {
         reset();
+        action_pairs_.reserve(env.getActionHistory().size());
         for (size_t i = 0; i < env.getActionHistory().size(); ++i) {
-            addActionPair(env.getActionHistory()[i], action_info_history.size() > i ? ActionInfo(action_info_history[i]) : ActionInfo());
+            addActionPair(env.getActionHistory()[i], action_info_history.size() > i ? action_info_history[i] : std::vector<std::pair<std::string, std::string>>{});
         }
         addTag("RE", std::to_string(env.getEvalScore()));
 
@@ -223,43 +277,248 @@ public:
         oss << "(;";
         for (const auto& t : tags_) { oss << t.first << "[" << escapeSGFString(t.second) << "]"; }
         for (const auto& p : action_pairs_) {
+            const ActionInfo& action_info = p.second;
             oss << ";" << playerToChar(p.first.getPlayer()) << "[" << p.first.getActionID() << "]";
-            for (const auto& info : p.second) { oss << info.first << "[" << escapeSGFString(info.second) << "]"; }
+            if (action_info.policy_size_ > 0) {
+                oss << "P[";
+                for (uint32_t i = action_info.policy_begin_; i < action_info.policy_begin_ + action_info.policy_size_; ++i) {
+                    oss << (i == action_info.policy_begin_ ? "" : ",") << policy_ids_[i] << ":" << floatToString(policy_counts_[i]);
+                }
+                oss << "]";
+            }
+            if (action_info.flags_ & ActionInfo::kHasValue) { oss << "V[" << floatToString(action_info.value_) << "]"; }
+            if (action_info.flags_ & ActionInfo::kHasReward) { oss << "R[" << floatToString(action_info.reward_) << "]"; }
+            for (const auto& info : action_info.other_info_) { oss << info.first << "[" << escapeSGFString(info.second) << "]"; }
         }
         oss << ")";
         return oss.str();
     }
 
+    // the record in the binary form of record files: tags, then fixed-width actions, values and rewards, then policies quantized to 16 bits
+    virtual std::string toBinary() const
+    {
+        utils::BinaryWriter writer;
+        writer.write<uint32_t>(tags_.size());
+        for (const auto& tag : tags_) {
+            writer.writeString(tag.first);
+            writer.writeString(tag.second);
+        }
+
+        const uint32_t length = action_pairs_.size();
+        std::vector<int32_t> action_ids(length);
+        std::vector<uint8_t> players(length);
+        std::vector<float> values(length), rewards(length);
+        std::vector<uint32_t> policy_ends(length);
+        std::vector<uint16_t> policy_entries; // pairs of action id and count quantized relative to the largest count
+        std::vector<std::pair<uint32_t, std::pair<std::string, std::string>>> other_info;
+        for (uint32_t pos = 0; pos < length; ++pos) {
+            const ActionInfo& action_info = action_pairs_[pos].second;
+            action_ids[pos] = action_pairs_[pos].first.getActionID();
+            players[pos] = static_cast<uint8_t>(action_pairs_[pos].first.getPlayer());
+            values[pos] = action_info.value_;
+            rewards[pos] = action_info.reward_;
+            for (const auto& info : action_info.other_info_) { other_info.push_back({pos, info}); }
+
+            const uint32_t policy_begin = action_info.policy_begin_, policy_end = action_info.policy_begin_ + action_info.policy_size_;
+            const float max_count = (action_info.policy_size_ > 0 ? *std::max_element(policy_counts_.begin() + policy_begin, policy_counts_.begin() + policy_end) : 0.0f);
+            for (uint32_t i = policy_begin; i < policy_end; ++i) {
+                const long quantized_count = std::lround(policy_counts_[i] / max_count * 0xFFFF);
+                policy_entries.push_back(policy_ids_[i]);
+                policy_entries.push_back(static_cast<uint16_t>(std::max(policy_counts_[i] > 0.0f ? 1L : 0L, quantized_count)));
+            }
+            policy_ends[pos] = policy_entries.size() / 2;
+        }
+
+        writer.write<uint32_t>(length);
+        writer.writeArray(action_ids.data(), length);
+        writer.writeArray(players.data(), length);
+        writer.writeArray(values.data(), length);
+        writer.writeArray(rewards.data(), length);
+        writer.writeArray(policy_ends.data(), length);
+        writer.writeArray(policy_entries.data(), policy_entries.size());
+        writer.write<uint32_t>(other_info.size());
+        for (const auto& info : other_info) {
+            writer.write<uint32_t>(info.first);
+            writer.writeString(info.second.first);
+            writer.writeString(info.second.second);
+        }
+        return std::move(writer.getBuffer());
+    }
+
+    virtual bool loadFromBinary(const char* data, size_t size)
+    {
+        reset();
+        utils::BinaryReader reader(data, size);
+        const uint32_t num_tags = reader.read<uint32_t>();
+        for (uint32_t i = 0; i < num_tags && reader.isValid(); ++i) {
+            std::string key = reader.readString();
+            tags_[key] = reader.readString();
+        }
+
+        const uint32_t length = reader.read<uint32_t>();
+        if (!reader.isValid() || length > size) { return false; }
+        std::vector<int32_t> action_ids(length);
+        std::vector<uint8_t> players(length);
+        std::vector<float> values(length), rewards(length);
+        std::vector<uint32_t> policy_ends(length);
+        reader.readArray(action_ids.data(), length);
+        reader.readArray(players.data(), length);
+        reader.readArray(values.data(), length);
+        reader.readArray(rewards.data(), length);
+        reader.readArray(policy_ends.data(), length);
+        const uint32_t num_policy_entries = (length > 0 ? policy_ends.back() : 0);
+        if (!reader.isValid() || num_policy_entries > size) { return false; }
+        std::vector<uint16_t> policy_entries(2 * num_policy_entries);
+        reader.readArray(policy_entries.data(), policy_entries.size());
+        if (!reader.isValid()) { return false; }
+
+        // a corrupted record must not replay illegal actions or index the policy out of range
+        const int policy_size = getPolicySize();
+        for (uint32_t pos = 0; pos < length; ++pos) {
+            if (action_ids[pos] < 0 || action_ids[pos] >= policy_size || players[pos] >= static_cast<uint8_t>(Player::kPlayerSize)) { return false; }
+            if (pos > 0 && policy_ends[pos] < policy_ends[pos - 1]) { return false; }
+        }
+        for (uint32_t entry = 0; entry < num_policy_entries; ++entry) {
+            if (policy_entries[2 * entry] >= policy_size) { return false; }
+        }
+
+        action_pairs_.resize(length);
+        policy_ids_.reserve(num_policy_entries);
+        policy_counts_.reserve(num_policy_entries);
+        for (uint32_t pos = 0; pos < length; ++pos) {
+            ActionInfo& action_info = action_pairs_[pos].second;
+            action_pairs_[pos].first = Action(action_ids[pos], static_cast<Player>(players[pos]));
+            action_info.value_ = values[pos];
+            action_info.reward_ = rewards[pos];
+            action_info.flags_ = ActionInfo::kHasValue | ActionInfo::kHasReward;
+            action_info.policy_begin_ = policy_ids_.size();
+            for (uint32_t entry = (pos > 0 ? policy_ends[pos - 1] : 0); entry < policy_ends[pos] && entry < num_policy_entries; ++entry) {
+                policy_ids_.push_back(policy_entries[2 * entry]);
+                policy_counts_.push_back(policy_entries[2 * entry + 1]);
+            }
+            action_info.policy_size_ = policy_ids_.size() - action_info.policy_begin_;
+        }
+
+        const uint32_t num_other_info = reader.read<uint32_t>();
+        for (uint32_t i = 0; i < num_other_info && reader.isValid(); ++i) {
+            const uint32_t pos = reader.read<uint32_t>();
+            std::string key = reader.readString();
+            std::string value = reader.readString();
+            if (pos < length) { setActionInfo(action_pairs_[pos].second, key, value); }
+        }
+        return reader.isValid();
+    }
+
     virtual std::vector<float> getFeatures(const int pos, utils::Rotation rotation = utils::Rotation::kRotationNone) const
+    {
+        if (pos < feature_cache_begin_ || pos >= feature_cache_end_) { return getFeaturesByReplay(pos, rotation); }
+        const int feature_size = feature_cache_.size() / (feature_cache_end_ - feature_cache_begin_);
+        std::vector<float> features(feature_size);
+        rotateFeatures(&feature_cache_[(pos - feature_cache_begin_) * feature_size], feature_size, rotation, features.data());
+        return features;
+    }
+
+    // the write functions store the training data of a position to the given memory, e.g., a slice of the training batch, without temporary vectors
+    // the defaults copy the results of the corresponding get functions, loaders override them where they can write directly
+    virtual void writeFeatures(const int pos, utils::Rotation rotation, float* features) const
+    {
+        if (pos < feature_cache_begin_ || pos >= feature_cache_end_) {
+            const std::vector<float> replayed_features = getFeatures(pos, rotation);
+            std::copy(replayed_features.begin(), replayed_features.end(), features);
+            return;
+        }
+        const int feature_size = feature_cache_.size() / (feature_cache_end_ - feature_cache_begin_);
+        rotateFeatures(&feature_cache_[(pos - feature_cache_begin_) * feature_size], feature_size, rotation, features);
+    }
+
+    virtual void writeActionFeatures(const int pos, utils::Rotation rotation, float* action_features) const
+    {
+        const std::vector<float> features = getActionFeatures(pos, rotation);
+        std::copy(features.begin(), features.end(), action_features);
+    }
+
+    virtual void writePolicy(const int pos, utils::Rotation rotation, float* policy) const
+    {
+        const int policy_size = getPolicySize();
+        if (pos >= static_cast<int>(action_pairs_.size())) { // absorbing states
+            std::fill(policy, policy + policy_size, 1.0f / policy_size);
+            return;
+        }
+
+        const ActionInfo& action_info = action_pairs_[pos].second;
+        std::fill(policy, policy + policy_size, 0.0f);
+        if (action_info.policy_size_ == 0) {
+            policy[getRotateAction(action_pairs_[pos].first.getActionID(), rotation)] = 1.0f;
+            return;
+        }
+        const uint32_t policy_begin = action_info.policy_begin_, policy_end = action_info.policy_begin_ + action_info.policy_size_;
+        float total = 0.0f;
+        for (uint32_t i = policy_begin; i < policy_end; ++i) { total += policy_counts_[i]; }
+        for (uint32_t i = policy_begin; i < policy_end; ++i) { policy[getRotateAction(policy_ids_[i], rotation)] = policy_counts_[i] / total; }
+    }
+
+    virtual void writeValue(const int pos, float* value) const
+    {
+        const std::vector<float> values = getValue(pos);
+        std::copy(values.begin(), values.end(), value);
+    }
+
+    virtual void writeReward(const int pos, float* reward) const
+    {
+        const std::vector<float> rewards = getReward(pos);
+        std::copy(rewards.begin(), rewards.end(), reward);
+    }
+
+    virtual std::vector<float> getFeaturesByReplay(const int pos, utils::Rotation rotation = utils::Rotation::kRotationNone) const
     {
         // a slow but naive method which simply replays the game again to get features
         Env env;
+        initializeReplayEnv(env);
         for (int i = 0; i < std::min(pos, static_cast<int>(action_pairs_.size())); ++i) { env.act(action_pairs_[i].first); }
         return env.getFeatures(rotation);
     }
 
-    virtual std::vector<float> getPolicy(const int pos, utils::Rotation rotation = utils::Rotation::kRotationNone) const
+    // replays the game once and keeps the unrotated features of positions [begin, end], so that getFeatures no longer replays the game for them
+    virtual void cacheFeatures(int begin, int end)
     {
-        std::vector<float> policy(getPolicySize(), 0.0f);
-        if (pos < static_cast<int>(action_pairs_.size())) {
-            const std::string policy_distribution = action_pairs_[pos].second["P"];
-            if (policy_distribution.empty()) {
-                policy[getRotateAction(action_pairs_[pos].first.getActionID(), rotation)] = 1.0f;
-            } else {
-                std::string tmp;
-                float total = 0.0f;
-                std::istringstream iss(policy_distribution);
-                while (std::getline(iss, tmp, ',')) {
-                    int position = getRotateAction(std::stoi(tmp.substr(0, tmp.find(":"))), rotation);
-                    float count = std::stof(tmp.substr(tmp.find(":") + 1));
-                    policy[position] = count;
-                    total += count;
-                }
-                for (auto& p : policy) { p /= total; }
+        clearFeatureCache();
+        end = std::min(end, static_cast<int>(action_pairs_.size()));
+        if (begin < 0 || begin > end) { return; }
+
+        Env env;
+        initializeReplayEnv(env);
+        for (int pos = 0; pos <= end; ++pos) {
+            if (pos >= begin) {
+                std::vector<float> features = env.getFeatures();
+                if (feature_cache_.empty()) { feature_cache_.reserve(features.size() * (end - begin + 1)); }
+                feature_cache_.insert(feature_cache_.end(), features.begin(), features.end());
             }
-        } else { // absorbing states
-            std::fill(policy.begin(), policy.end(), 1.0f / getPolicySize());
+            if (pos < static_cast<int>(action_pairs_.size())) { env.act(action_pairs_[pos].first); }
         }
+        feature_cache_begin_ = begin;
+        feature_cache_end_ = end + 1;
+    }
+
+    // updates the value used for training without parsing, e.g., when the learner reanalyzes priorities
+    inline bool setValue(const int pos, float value)
+    {
+        if (pos >= static_cast<int>(action_pairs_.size())) { return false; }
+        action_pairs_[pos].second.value_ = value;
+        action_pairs_[pos].second.flags_ |= ActionInfo::kHasValue;
+        return true;
+    }
+
+    inline void clearFeatureCache()
+    {
+        feature_cache_begin_ = feature_cache_end_ = 0;
+        std::vector<float>().swap(feature_cache_);
+    }
+    inline size_t getFeatureCacheBytes() const { return feature_cache_.capacity() * sizeof(float); }
+
+    virtual std::vector<float> getPolicy(const int pos, utils::Rotation rotation = utils::Rotation::kRotationNone) const
+    {
+        std::vector<float> policy(getPolicySize());
+        writePolicy(pos, rotation, policy.data());
         return policy;
     }
 
@@ -273,12 +532,12 @@ public:
         }
     }
 
-    virtual std::vector<float> getValue(const int pos) const { return (pos < static_cast<int>(action_pairs_.size()) ? std::vector<float>{std::stof(action_pairs_[pos].second["V"])} : std::vector<float>{0.0f}); }
-    virtual std::vector<float> getReward(const int pos) const { return (pos < static_cast<int>(action_pairs_.size()) ? std::vector<float>{std::stof(action_pairs_[pos].second["R"])} : std::vector<float>{0.0f}); }
+    virtual std::vector<float> getValue(const int pos) const { return {pos < static_cast<int>(action_pairs_.size()) ? action_pairs_[pos].second.value_ : 0.0f}; }
+    virtual std::vector<float> getReward(const int pos) const { return {pos < static_cast<int>(action_pairs_.size()) ? action_pairs_[pos].second.reward_ : 0.0f}; }
     virtual bool setActionPairInfo(const int pos, const std::string& tag, const std::string value)
     {
         if (pos >= static_cast<int>(action_pairs_.size())) { return false; }
-        action_pairs_[pos].second[tag] = value;
+        setActionInfo(action_pairs_[pos].second, tag, value);
         return true;
     }
     virtual float getPriority(const int pos) const { return 1.0f; }
@@ -291,13 +550,115 @@ public:
     virtual inline std::string getTag(const std::string& key) const { return tags_.count(key) ? tags_.at(key) : ""; }
     virtual inline void addTag(const std::string& key, const std::string& value) { tags_[key] = value; }
 
+    // allocates the records of later loads from arena, e.g., so that the replay buffer releases the games of one file at once
+    inline void setArena(const std::shared_ptr<utils::Arena>& arena)
+    {
+        action_pairs_ = ActionPairs(utils::ArenaAllocator<std::pair<Action, ActionInfo>>(arena));
+        policy_ids_ = std::vector<uint16_t, utils::ArenaAllocator<uint16_t>>(utils::ArenaAllocator<uint16_t>(arena));
+        policy_counts_ = std::vector<float, utils::ArenaAllocator<float>>(utils::ArenaAllocator<float>(arena));
+    }
+
+    // the loaded sgf is only kept on request, since the loader can rebuild the record by toString()
+    inline void setKeepSGFContent(bool keep_sgf_content) { keep_sgf_content_ = keep_sgf_content; }
     inline std::string getSGFContent() const { return sgf_content_; }
-    inline std::vector<std::pair<Action, ActionInfo>>& getActionPairs() { return action_pairs_; }
-    inline const std::vector<std::pair<Action, ActionInfo>>& getActionPairs() const { return action_pairs_; }
-    inline void addActionPair(const Action& action, const ActionInfo& action_info = {}) { action_pairs_.emplace_back(action, action_info); }
+    inline ActionPairs& getActionPairs() { return action_pairs_; }
+    inline const ActionPairs& getActionPairs() const { return action_pairs_; }
+    inline void addActionPair(const Action& action, const std::vector<std::pair<std::string, std::string>>& action_info = {})
+    {
+        action_pairs_.emplace_back().first = action;
+        for (const auto& info : action_info) { setActionInfo(action_pairs_.back().second, info.first, info.second); }
+    }
     inline float getReturn() const { return std::stof(getTag("RE")); }
 
 protected:
+    // reserves the exact sizes before parsing, since memory outgrown in an arena is only released with the arena
+    void reserveActionPairs(const std::string& content)
+    {
+        // a move starts with ";B[", while tags can only contain escaped brackets
+        size_t num_moves = 0, first_move = content.size();
+        for (size_t i = 0; i + 2 < content.size(); ++i) {
+            if (content[i] != ';' || !std::isalpha(content[i + 1]) || content[i + 2] != '[') { continue; }
+            first_move = std::min(first_move, i);
+            ++num_moves;
+        }
+        const size_t num_policy_entries = std::count(content.begin() + first_move, content.end(), ':');
+        action_pairs_.reserve(num_moves);
+        policy_ids_.reserve(num_policy_entries);
+        policy_counts_.reserve(num_policy_entries);
+    }
+
+    void setActionInfo(ActionInfo& action_info, const std::string& key, const std::string& value)
+    {
+        if (key == "P") {
+            // format: "action_id:count,action_id:count,..."
+            action_info.policy_begin_ = policy_ids_.size();
+            for (const char* p = value.c_str(); *p;) {
+                char* end = nullptr;
+                const long action_id = std::strtol(p, &end, 10);
+                if (end == p || *end != ':') { break; }
+                const float count = std::strtof(end + 1, &end);
+                assert(action_id >= 0 && action_id <= 0xFFFF);
+                policy_ids_.push_back(action_id);
+                policy_counts_.push_back(count);
+                p = (*end == ',' ? end + 1 : end);
+            }
+            assert(policy_ids_.size() - action_info.policy_begin_ <= 0xFFFF);
+            action_info.policy_size_ = policy_ids_.size() - action_info.policy_begin_;
+        } else if (key == "V") {
+            action_info.value_ = (value.empty() ? 0.0f : std::stof(value));
+            action_info.flags_ |= ActionInfo::kHasValue;
+        } else if (key == "R") {
+            action_info.reward_ = (value.empty() ? 0.0f : std::stof(value));
+            action_info.flags_ |= ActionInfo::kHasReward;
+        } else {
+            auto it = std::find_if(action_info.other_info_.begin(), action_info.other_info_.end(), [&key](const std::pair<std::string, std::string>& info) { return info.first == key; });
+            if (it != action_info.other_info_.end()) {
+                it->second = value;
+            } else {
+                action_info.other_info_.emplace_back(key, value);
+            }
+        }
+    }
+
+    // the shortest form with at least 6 significant digits that reads back as the same float
+    static std::string floatToString(float value)
+    {
+        char buffer[32];
+        for (int precision = 6; precision <= 9; ++precision) {
+            std::snprintf(buffer, sizeof(buffer), "%.*g", precision, value);
+            if (std::strtof(buffer, nullptr) == value) { break; }
+        }
+        return buffer;
+    }
+
+    // sets up a fresh environment before replaying the recorded actions, e.g., with the recorded seed
+    virtual void initializeReplayEnv(Env& env) const {}
+
+    // rotates the unrotated features of one position into rotated_features; the default is for environments whose features ignore the rotation
+    virtual void rotateFeatures(const float* features, int feature_size, utils::Rotation rotation, float* rotated_features) const
+    {
+        std::copy(features, features + feature_size, rotated_features);
+    }
+
+    // rotates each plane of the features, where the feature at position p is read from position getRotatePosition(p, plane_rotation)
+    void rotateFeaturePlanes(const float* features, int feature_size, int plane_size, utils::Rotation plane_rotation, float* rotated_features) const
+    {
+        if (plane_rotation == utils::Rotation::kRotationNone) {
+            std::copy(features, features + feature_size, rotated_features);
+            return;
+        }
+
+        // the positions of the last used plane size are kept per thread and rotation, since a loader mostly rotates planes of one size
+        assert(plane_size > 0 && feature_size % plane_size == 0);
+        thread_local std::vector<int> plane_positions[static_cast<int>(utils::Rotation::kRotateSize)];
+        std::vector<int>& positions = plane_positions[static_cast<int>(plane_rotation)];
+        if (static_cast<int>(positions.size()) != plane_size) {
+            positions.resize(plane_size);
+            for (int pos = 0; pos < plane_size; ++pos) { positions[pos] = getRotatePosition(pos, plane_rotation); }
+        }
+        utils::permutePlanes(features, feature_size / plane_size, plane_size, positions.data(), rotated_features);
+    }
+
     std::string escapeSGFString(const std::string& str) const
     {
         std::string special = "()[]\\";
@@ -313,7 +674,13 @@ protected:
 protected:
     std::string sgf_content_;
     Tags tags_;
-    std::vector<std::pair<Action, ActionInfo>> action_pairs_;
+    bool keep_sgf_content_;
+    ActionPairs action_pairs_;
+    std::vector<uint16_t, utils::ArenaAllocator<uint16_t>> policy_ids_;
+    std::vector<float, utils::ArenaAllocator<float>> policy_counts_;
+    int feature_cache_begin_;
+    int feature_cache_end_;
+    std::vector<float> feature_cache_;
 };
 
 template <int kNumPlayer = 2>
@@ -356,6 +723,10 @@ template <class Action, class Env>
 class BaseBoardEnvLoader : public BaseEnvLoader<Action, Env> {
 public:
     BaseBoardEnvLoader() : board_size_(minizero::config::env_board_size) {}
+    BaseBoardEnvLoader(const BaseBoardEnvLoader&) = default;
+    BaseBoardEnvLoader(BaseBoardEnvLoader&&) = default;
+    BaseBoardEnvLoader& operator=(const BaseBoardEnvLoader&) = default;
+    BaseBoardEnvLoader& operator=(BaseBoardEnvLoader&&) = default;
     virtual ~BaseBoardEnvLoader() = default;
 
     void loadFromEnvironment(const Env& env, const std::vector<std::vector<std::pair<std::string, std::string>>>& action_info_history = {}) override
@@ -373,6 +744,12 @@ public:
     inline int getBoardSize() const { return board_size_; }
 
 protected:
+    void rotateFeatures(const float* features, int feature_size, utils::Rotation rotation, float* rotated_features) const override
+    {
+        // board environments build the features by reading the board at the reversely rotated positions
+        BaseEnvLoader<Action, Env>::rotateFeaturePlanes(features, feature_size, board_size_ * board_size_, utils::reversed_rotation[static_cast<int>(rotation)], rotated_features);
+    }
+
     int board_size_;
 };
 
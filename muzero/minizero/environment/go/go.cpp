@@ -1,7 +1,9 @@
 #include "go.h"
 #include "color_message.h"
+#include "go_feature_encoder.h"
 #include "random.h"
 #include "sgf_loader.h"
+#include <algorithm>
 #include <random>
 #include <sstream>
 #include <string>
@@ -78,17 +80,32 @@ GoEnv& GoEnv::operator=(const GoEnv& env)
     board_mask_bitboard_ = env.board_mask_bitboard_;
     board_left_boundary_bitboard_ = env.board_left_boundary_bitboard_;
     board_right_boundary_bitboard_ = env.board_right_boundary_bitboard_;
-    free_area_id_bitboard_ = env.free_area_id_bitboard_;
-    free_block_id_bitboard_ = env.free_block_id_bitboard_;
     stone_bitboard_ = env.stone_bitboard_;
     benson_bitboard_ = env.benson_bitboard_;
+    legal_bitboard_ = env.legal_bitboard_;
     grids_ = env.grids_;
-    areas_ = env.areas_;
-    blocks_ = env.blocks_;
+    if (blocks_.size() == env.blocks_.size()) {
+        // unused blocks and areas are always in their reset state, so only the ones used by either environment are copied
+        GoBitboard block_id_bitboard = ~(free_block_id_bitboard_ & env.free_block_id_bitboard_) & env.board_mask_bitboard_;
+        while (!block_id_bitboard.none()) {
+            int id = block_id_bitboard.popFirst();
+            blocks_[id] = env.blocks_[id];
+        }
+        GoBitboard area_id_bitboard = ~(free_area_id_bitboard_ & env.free_area_id_bitboard_) & env.board_mask_bitboard_;
+        while (!area_id_bitboard.none()) {
+            int id = area_id_bitboard.popFirst();
+            areas_[id] = env.areas_[id];
+        }
+    } else {
+        areas_ = env.areas_;
+        blocks_ = env.blocks_;
+    }
+    free_area_id_bitboard_ = env.free_area_id_bitboard_;
+    free_block_id_bitboard_ = env.free_block_id_bitboard_;
     actions_ = env.actions_;
     stone_bitboard_history_ = env.stone_bitboard_history_;
     hashkey_history_ = env.hashkey_history_;
-    hash_table_ = env.hash_table_;
+    hash_key_filter_ = env.hash_key_filter_;
 
     // reset grid's block and area pointer
     for (auto& grid : grids_) {
@@ -126,7 +143,8 @@ void GoEnv::reset()
     actions_.clear();
     stone_bitboard_history_.clear();
     hashkey_history_.clear();
-    hash_table_.clear();
+    hash_key_filter_.reset();
+    updateLegalBitboard();
 }
 
 bool GoEnv::act(const GoAction& action)
@@ -144,7 +162,8 @@ bool GoEnv::act(const GoAction& action)
     if (isPassAction(action)) {
         stone_bitboard_history_.push_back(stone_bitboard_);
         hashkey_history_.push_back(hash_key_);
-        hash_table_.insert(hash_key_);
+        hash_key_filter_.set(hash_key_ % kHashKeyFilterSize);
+        updateLegalBitboard();
         return true;
     }
 
@@ -179,11 +198,12 @@ bool GoEnv::act(const GoAction& action)
     stone_bitboard_.get(player) |= new_block->getGridBitboard();
     stone_bitboard_history_.push_back(stone_bitboard_);
     hashkey_history_.push_back(hash_key_);
-    hash_table_.insert(hash_key_);
+    hash_key_filter_.set(hash_key_ % kHashKeyFilterSize);
 
     // update area & benson
     updateArea(action);
     updateBenson(action);
+    updateLegalBitboard();
 
     assert(checkDataStructure());
     return true;
@@ -196,12 +216,16 @@ bool GoEnv::act(const std::vector<std::string>& action_string_args)
 
 std::vector<GoAction> GoEnv::getLegalActions() const
 {
+    // derived environments may forbid more moves in isLegalAction(), so the moves in the legal bitboard are still checked with it
     std::vector<GoAction> actions;
-    for (int pos = 0; pos <= board_size_ * board_size_; ++pos) {
-        GoAction action(pos, turn_);
+    GoBitboard legal_bitboard = legal_bitboard_.get(turn_);
+    while (!legal_bitboard.none()) {
+        GoAction action(legal_bitboard.popFirst(), turn_);
         if (!isLegalAction(action)) { continue; }
         actions.push_back(action);
     }
+    GoAction pass_action(board_size_ * board_size_, turn_);
+    if (isLegalAction(pass_action)) { actions.push_back(pass_action); }
     return actions;
 }
 
@@ -211,36 +235,7 @@ bool GoEnv::isLegalAction(const GoAction& action) const
     assert(action.getPlayer() == Player::kPlayer1 || action.getPlayer() == Player::kPlayer2);
 
     if (isPassAction(action)) { return true; }
-
-    const int position = action.getActionID();
-    const Player player = action.getPlayer();
-    const GoGrid& grid = grids_[position];
-    if (grid.getPlayer() != Player::kPlayerNone) { return false; }
-
-    bool is_legal = false;
-    GoBitboard check_neighbor_block_bitboard;
-    GoHashKey new_hash_key = hash_key_ ^ getGoTurnHashKey() ^ getGoGridHashKey(position, player);
-    for (const auto& neighbor_pos : grid.getNeighbors()) {
-        const GoGrid& neighbor_grid = grids_[neighbor_pos];
-        if (neighbor_grid.getPlayer() == Player::kPlayerNone) {
-            is_legal = true;
-        } else {
-            const GoBlock* neighbor_block = neighbor_grid.getBlock();
-            if (check_neighbor_block_bitboard.test(neighbor_block->getID())) { continue; }
-
-            check_neighbor_block_bitboard.set(neighbor_block->getID());
-            if (neighbor_block->getPlayer() == player) {
-                if (neighbor_block->getNumLiberty() > 1) { is_legal = true; }
-            } else {
-                if (neighbor_block->getNumLiberty() == 1) {
-                    new_hash_key ^= neighbor_block->getHashKey();
-                    is_legal = true;
-                }
-            }
-        }
-    }
-
-    return (is_legal && hash_table_.count(new_hash_key) == 0);
+    return legal_bitboard_.get(action.getPlayer()).test(action.getActionID());
 }
 
 bool GoEnv::isTerminal() const
@@ -284,27 +279,38 @@ std::vector<float> GoEnv::getFeatures(utils::Rotation rotation /*= utils::Rotati
         16. black turn
         17. white turn
     */
-    std::vector<float> vFeatures;
-    for (int channel = 0; channel < 18; ++channel) {
-        for (int pos = 0; pos < board_size_ * board_size_; ++pos) {
-            int rotation_pos = getRotatePosition(pos, utils::reversed_rotation[static_cast<int>(rotation)]);
-            if (channel < 16) {
-                int last_n_turn = stone_bitboard_history_.size() - 1 - channel / 2;
-                if (last_n_turn < 0) {
-                    vFeatures.push_back(0.0f);
-                } else {
-                    const GamePair<GoBitboard>& last_n_trun_stone_bitboard = stone_bitboard_history_[last_n_turn];
-                    Player player = (channel % 2 == 0 ? turn_ : getNextPlayer(turn_, kGoNumPlayer));
-                    vFeatures.push_back(last_n_trun_stone_bitboard.get(player).test(rotation_pos) ? 1.0f : 0.0f);
-                }
-            } else if (channel == 16) {
-                vFeatures.push_back((turn_ == Player::kPlayer1 ? 1.0f : 0.0f));
-            } else if (channel == 17) {
-                vFeatures.push_back((turn_ == Player::kPlayer2 ? 1.0f : 0.0f));
-            }
+    std::vector<float> vFeatures(getNumInputChannels() * board_size_ * board_size_);
+    writeFeatures(vFeatures.data(), rotation);
+    return vFeatures;
+}
+
+void GoEnv::writeFeatures(float* features, utils::Rotation rotation /*= utils::Rotation::kRotationNone*/) const
+{
+    // the stone planes are expanded from the bitboards, and rotated features are gathered from the unrotated planes afterwards
+    const int plane_size = board_size_ * board_size_;
+    const int num_stone_channels = 16;
+    thread_local std::vector<float> unrotated_planes;
+    float* stone_planes = features;
+    if (rotation != utils::Rotation::kRotationNone) {
+        unrotated_planes.resize(num_stone_channels * plane_size);
+        stone_planes = unrotated_planes.data();
+    }
+    for (int channel = 0; channel < num_stone_channels; ++channel) {
+        float* plane = stone_planes + channel * plane_size;
+        int last_n_turn = stone_bitboard_history_.size() - 1 - channel / 2;
+        if (last_n_turn < 0) {
+            std::fill(plane, plane + plane_size, 0.0f);
+        } else {
+            Player player = (channel % 2 == 0 ? turn_ : getNextPlayer(turn_, kGoNumPlayer));
+            GoFeatureEncoder::expandBitboard(stone_bitboard_history_[last_n_turn].get(player), plane_size, plane);
         }
     }
-    return vFeatures;
+    if (rotation != utils::Rotation::kRotationNone) {
+        const int* rotation_positions = utils::getRotationTable(utils::reversed_rotation[static_cast<int>(rotation)], board_size_);
+        utils::permutePlanes(stone_planes, num_stone_channels, plane_size, rotation_positions, features);
+    }
+    std::fill(features + 16 * plane_size, features + 17 * plane_size, (turn_ == Player::kPlayer1 ? 1.0f : 0.0f));
+    std::fill(features + 17 * plane_size, features + 18 * plane_size, (turn_ == Player::kPlayer2 ? 1.0f : 0.0f));
 }
 
 std::vector<float> GoEnv::getActionFeatures(const GoAction& action, utils::Rotation rotation /*= utils::Rotation::kRotationNone*/) const
@@ -348,14 +354,22 @@ std::string GoEnv::toString() const
     return oss.str();
 }
 
+GoHashKey GoEnv::getTranspositionKey() const
+{
+    // the features contain the stones of the last 8 turns and the turn, so the positions are rotated by their age before combining
+    GoHashKey hash_key = (turn_ == Player::kPlayer1 ? 0 : turn_hash_key);
+    const int history_size = hashkey_history_.size();
+    for (int i = 0; i < std::min(8, history_size); ++i) {
+        const GoHashKey position_hash_key = hashkey_history_[history_size - 1 - i];
+        const int shift = i * 7 + 1;
+        hash_key ^= (position_hash_key << shift) | (position_hash_key >> (64 - shift));
+    }
+    return hash_key;
+}
+
 GoBitboard GoEnv::dilateBitboard(const GoBitboard& bitboard) const
 {
-    return ((bitboard << board_size_) |                           // move up
-            (bitboard >> board_size_) |                           // move down
-            ((bitboard & ~board_left_boundary_bitboard_) >> 1) |  // move left
-            ((bitboard & ~board_right_boundary_bitboard_) << 1) | // move right
-            bitboard) &
-           board_mask_bitboard_;
+    return bitboard.dilate(board_size_, board_left_boundary_bitboard_, board_right_boundary_bitboard_, board_mask_bitboard_);
 }
 
 void GoEnv::initialize()
@@ -373,8 +387,7 @@ void GoEnv::initialize()
 GoBlock* GoEnv::newBlock()
 {
     assert(!free_block_id_bitboard_.none());
-    int id = free_block_id_bitboard_._Find_first();
-    free_block_id_bitboard_.reset(id);
+    int id = free_block_id_bitboard_.popFirst();
     return &blocks_[id];
 }
 
@@ -393,8 +406,7 @@ void GoEnv::removeBlockFromBoard(GoBlock* block)
     GoArea* area = nullptr;
     GoBitboard area_id = block->getNeighborAreaIDBitboard();
     while (!area_id.none()) {
-        int id = area_id._Find_first();
-        area_id.reset(id);
+        int id = area_id.popFirst();
         if (!area) {
             area = &areas_[id];
         } else {
@@ -414,8 +426,7 @@ void GoEnv::removeBlockFromBoard(GoBlock* block)
     // remove block
     GoBitboard grid_bitboard = block->getGridBitboard();
     while (!grid_bitboard.none()) {
-        int pos = grid_bitboard._Find_first();
-        grid_bitboard.reset(pos);
+        int pos = grid_bitboard.popFirst();
 
         GoGrid& grid = grids_[pos];
         grid.setPlayer(Player::kPlayerNone);
@@ -442,16 +453,14 @@ GoBlock* GoEnv::combineBlocks(GoBlock* block1, GoBlock* block2)
     // link grid to new block
     GoBitboard grid_bitboard = block2->getGridBitboard();
     while (!grid_bitboard.none()) {
-        int pos = grid_bitboard._Find_first();
-        grid_bitboard.reset(pos);
+        int pos = grid_bitboard.popFirst();
         grids_[pos].setBlock(block1);
     }
 
     // link area to new block
     GoBitboard new_area_id_bitboard = block2->getNeighborAreaIDBitboard();
     while (!new_area_id_bitboard.none()) {
-        int id = new_area_id_bitboard._Find_first();
-        new_area_id_bitboard.reset(id);
+        int id = new_area_id_bitboard.popFirst();
         areas_[id].removeNeighborBlockIDBitboard(block2->getID());
         areas_[id].addNeighborBlockIDBitboard(block1->getID());
     }
@@ -496,8 +505,7 @@ void GoEnv::addArea(Player player, const GoBitboard& area_bitboard)
     assert(!free_area_id_bitboard_.none());
 
     // get available area id
-    int area_id = free_area_id_bitboard_._Find_first();
-    free_area_id_bitboard_.reset(area_id);
+    int area_id = free_area_id_bitboard_.popFirst();
 
     GoArea* area = &areas_[area_id];
     area->setNumGrid(area_bitboard.count());
@@ -507,15 +515,14 @@ void GoEnv::addArea(Player player, const GoBitboard& area_bitboard)
     // link grids pointer
     GoBitboard grid_bitboard = area_bitboard;
     while (!grid_bitboard.none()) {
-        int pos = grid_bitboard._Find_first();
-        grid_bitboard.reset(pos);
+        int pos = grid_bitboard.popFirst();
         grids_[pos].setArea(player, area);
     }
 
     // link blocks pointer
     GoBitboard neighbor_block_bitboard = dilateBitboard(area_bitboard) & stone_bitboard_.get(player);
     while (!neighbor_block_bitboard.none()) {
-        int pos = neighbor_block_bitboard._Find_first();
+        int pos = neighbor_block_bitboard.findFirst();
         GoBlock* block = grids_[pos].getBlock();
         block->addNeighborAreaIDBitboard(area->getID());
         area->addNeighborBlockIDBitboard(block->getID());
@@ -530,16 +537,14 @@ void GoEnv::removeArea(GoArea* area)
     // remove grids pointer
     GoBitboard area_bitboard = area->getAreaBitboard();
     while (!area_bitboard.none()) {
-        int pos = area_bitboard._Find_first();
-        area_bitboard.reset(pos);
+        int pos = area_bitboard.popFirst();
         grids_[pos].setArea(area->getPlayer(), nullptr);
     }
 
     // remove blocks pointer
     GoBitboard neighbor_block_id = area->getNeighborBlockIDBitboard();
     while (!neighbor_block_id.none()) {
-        int block_id = neighbor_block_id._Find_first();
-        neighbor_block_id.reset(block_id);
+        int block_id = neighbor_block_id.popFirst();
         blocks_[block_id].removeNeighborAreaIDBitboard(area->getID());
     }
 
@@ -558,13 +563,11 @@ GoArea* GoEnv::mergeArea(GoArea* area1, GoArea* area2)
     area1->combineWithArea(area2);
     removeArea(area2);
     while (!area2_bitboard.none()) { // link grid to area
-        int pos = area2_bitboard._Find_first();
-        area2_bitboard.reset(pos);
+        int pos = area2_bitboard.popFirst();
         grids_[pos].setArea(area1->getPlayer(), area1);
     }
     while (!area2_nbr_block_id.none()) { // link block to area
-        int id = area2_nbr_block_id._Find_first();
-        area2_nbr_block_id.reset(id);
+        int id = area2_nbr_block_id.popFirst();
         blocks_[id].addNeighborAreaIDBitboard(area1->getID());
     }
     return area1;
@@ -618,14 +621,13 @@ GoBitboard GoEnv::findBensonBitboard(GoBitboard block_bitboard) const
     std::vector<GoBitboard> block_neighbor_vital_areas(board_size_ * board_size_, GoBitboard());
     GoBitboard stone_bitboard = stone_bitboard_.get(Player::kPlayer1) | stone_bitboard_.get(Player::kPlayer2);
     while (!block_bitboard.none()) {
-        int pos = block_bitboard._Find_first();
+        int pos = block_bitboard.findFirst();
         const GoBlock* block = grids_[pos].getBlock();
         block_bitboard &= ~block->getGridBitboard();
 
         GoBitboard block_neighbor_area_id = block->getNeighborAreaIDBitboard();
         while (!block_neighbor_area_id.none()) {
-            int area_id = block_neighbor_area_id._Find_first();
-            block_neighbor_area_id.reset(area_id);
+            int area_id = block_neighbor_area_id.popFirst();
 
             const GoArea* area = &areas_[area_id];
             if (!(area->getAreaBitboard() & ~block->getLibertyBitboard() & ~stone_bitboard).none()) { continue; }
@@ -645,8 +647,7 @@ GoBitboard GoEnv::findBensonBitboard(GoBitboard block_bitboard) const
         // 1. Remove from X all Black chains with less than two vital Black-enclosed regions in R
         GoBitboard next_benson_block_id;
         while (!benson_block_id.none()) {
-            int block_id = benson_block_id._Find_first();
-            benson_block_id.reset(block_id);
+            int block_id = benson_block_id.popFirst();
 
             if ((block_neighbor_vital_areas[block_id] & benson_area_id).count() < 2) {
                 is_over = false;
@@ -660,8 +661,7 @@ GoBitboard GoEnv::findBensonBitboard(GoBitboard block_bitboard) const
         // 2. Remove from R all Black - enclosed regions with a surrounding stone in a chain not in X
         GoBitboard next_benson_area_id;
         while (!benson_area_id.none()) {
-            int area_id = benson_area_id._Find_first();
-            benson_area_id.reset(area_id);
+            int area_id = benson_area_id.popFirst();
 
             if (!(areas_[area_id].getNeighborBlockIDBitboard() & ~benson_block_id).none()) {
                 is_over = false;
@@ -675,6 +675,71 @@ GoBitboard GoEnv::findBensonBitboard(GoBitboard block_bitboard) const
     return benson_bitboard;
 }
 
+void GoEnv::updateLegalBitboard()
+{
+    // a move is legal if it has an empty neighbor, extends an own block which keeps another liberty, or captures an opponent block in atari,
+    // and the position after it does not appear in the history (superko)
+    GamePair<GoBitboard> safe_liberty_bitboard, atari_liberty_bitboard;
+    GoBitboard block_id_bitboard = ~free_block_id_bitboard_ & board_mask_bitboard_;
+    while (!block_id_bitboard.none()) {
+        const GoBlock& block = blocks_[block_id_bitboard.popFirst()];
+        (block.getNumLiberty() == 1 ? atari_liberty_bitboard : safe_liberty_bitboard).get(block.getPlayer()) |= block.getLibertyBitboard();
+    }
+    const GoBitboard empty_bitboard = ~(stone_bitboard_.get(Player::kPlayer1) | stone_bitboard_.get(Player::kPlayer2)) & board_mask_bitboard_;
+    const GoBitboard empty_neighbor_bitboard = empty_bitboard.getNeighbors(board_size_, board_left_boundary_bitboard_, board_right_boundary_bitboard_, board_mask_bitboard_);
+    for (const Player player : {Player::kPlayer1, Player::kPlayer2}) {
+        const Player opponent = getNextPlayer(player, kGoNumPlayer);
+        GoBitboard& legal_bitboard = legal_bitboard_.get(player);
+        legal_bitboard = empty_bitboard & (empty_neighbor_bitboard | safe_liberty_bitboard.get(player) | atari_liberty_bitboard.get(opponent));
+
+        // a capture may lead to any earlier position, so the hash key after each capture is looked up
+        GoBitboard capture_bitboard = legal_bitboard & atari_liberty_bitboard.get(opponent);
+        while (!capture_bitboard.none()) {
+            int pos = capture_bitboard.popFirst();
+            if (isInHashKeyHistory(getNextHashKey(pos, player))) { legal_bitboard.reset(pos); }
+        }
+
+        // any other move only adds one stone, so it can only lead to an earlier position with the same opponent stones and exactly one more own stone
+        const GoBitboard& own_stone_bitboard = stone_bitboard_.get(player);
+        const GoBitboard& opponent_stone_bitboard = stone_bitboard_.get(opponent);
+        for (const auto& stone_bitboard : stone_bitboard_history_) {
+            if (stone_bitboard.get(opponent) != opponent_stone_bitboard) { continue; }
+            GoBitboard added_bitboard = stone_bitboard.get(player) & ~own_stone_bitboard;
+            if (added_bitboard.count() != 1 || !(own_stone_bitboard & ~stone_bitboard.get(player)).none()) { continue; }
+            int pos = added_bitboard.findFirst();
+            if (!legal_bitboard.test(pos) || atari_liberty_bitboard.get(opponent).test(pos)) { continue; }
+            if (isInHashKeyHistory(getNextHashKey(pos, player))) { legal_bitboard.reset(pos); }
+        }
+    }
+}
+
+bool GoEnv::isInHashKeyHistory(GoHashKey hash_key) const
+{
+    // the filter rules out most keys, and the others are searched from the latest position, since a repetition is most likely a ko
+    if (!hash_key_filter_.test(hash_key % kHashKeyFilterSize)) { return false; }
+    for (auto it = hashkey_history_.rbegin(); it != hashkey_history_.rend(); ++it) {
+        if (*it == hash_key) { return true; }
+    }
+    return false;
+}
+
+GoHashKey GoEnv::getNextHashKey(int position, Player player) const
+{
+    GoBitboard check_neighbor_block_bitboard;
+    GoHashKey new_hash_key = hash_key_ ^ getGoTurnHashKey() ^ getGoGridHashKey(position, player);
+    for (const auto& neighbor_pos : grids_[position].getNeighbors()) {
+        const GoGrid& neighbor_grid = grids_[neighbor_pos];
+        if (neighbor_grid.getPlayer() == Player::kPlayerNone || neighbor_grid.getPlayer() == player) { continue; }
+
+        const GoBlock* neighbor_block = neighbor_grid.getBlock();
+        if (check_neighbor_block_bitboard.test(neighbor_block->getID())) { continue; }
+
+        check_neighbor_block_bitboard.set(neighbor_block->getID());
+        if (neighbor_block->getNumLiberty() == 1) { new_hash_key ^= neighbor_block->getHashKey(); }
+    }
+    return new_hash_key;
+}
+
 std::string GoEnv::getCoordinateString() const
 {
     std::ostringstream oss;
@@ -705,7 +770,7 @@ GamePair<float> GoEnv::calculateTrompTaylorTerritory() const
     GamePair<float> territory(stone_bitboard_.get(Player::kPlayer1).count(), stone_bitboard_.get(Player::kPlayer2).count() + komi_);
     GoBitboard empty_stone_bitboard = ~(stone_bitboard_.get(Player::kPlayer1) | stone_bitboard_.get(Player::kPlayer2)) & board_mask_bitboard_;
     while (!empty_stone_bitboard.none()) {
-        int pos = empty_stone_bitboard._Find_first();
+        int pos = empty_stone_bitboard.findFirst();
 
         // check is surrounded by only one's color
         GoBitboard flood_fill_bitboard = floodFillBitBoard(pos, empty_stone_bitboard);
@@ -6,9 +6,9 @@
 #include "go_block.h"
 #include "go_grid.h"
 #include "go_unit.h"
+#include <bitset>
 #include <string>
 #include <unordered_map>
-#include <unordered_set>
 #include <utility>
 #include <vector>
 
@@ -29,6 +29,8 @@ typedef BaseBoardAction<kGoNumPlayer> GoAction;
 
 class GoEnv : public BaseBoardEnv<GoAction> {
 public:
+    static const int kHashKeyFilterSize = 4096;
+
     friend class GoBenson;
 
     GoEnv()
@@ -49,10 +51,12 @@ public:
     float getReward() const override { return 0.0f; }
     float getEvalScore(bool is_resign = false) const override;
     std::vector<float> getFeatures(utils::Rotation rotation = utils::Rotation::kRotationNone) const override;
+    void writeFeatures(float* features, utils::Rotation rotation = utils::Rotation::kRotationNone) const override;
     std::vector<float> getActionFeatures(const GoAction& action, utils::Rotation rotation = utils::Rotation::kRotationNone) const override;
     inline int getNumInputChannels() const override { return 18; }
     inline int getPolicySize() const override { return getBoardSize() * getBoardSize() + 1; }
     std::string toString() const override;
+    GoHashKey getTranspositionKey() const override;
     GoBitboard dilateBitboard(const GoBitboard& bitboard) const;
 
     inline std::string name() const override { return kGoName + "_" + std::to_string(getBoardSize()) + "x" + std::to_string(getBoardSize()); }
@@ -64,12 +68,12 @@ public:
     inline const GoBitboard& getFreeBlockIDBitBoard() const { return free_block_id_bitboard_; }
     inline const GamePair<GoBitboard>& getStoneBitboard() const { return stone_bitboard_; }
     inline const GamePair<GoBitboard>& getBensonBitboard() const { return benson_bitboard_; }
+    inline const GamePair<GoBitboard>& getLegalBitboard() const { return legal_bitboard_; }
     inline const GoGrid& getGrid(int id) const { return grids_[id]; }
     inline const GoArea& getArea(int id) const { return areas_[id]; }
     inline const GoBlock& getBlock(int id) const { return blocks_[id]; }
     inline bool isPassAction(const GoAction& action) const { return (action.getActionID() == getBoardSize() * getBoardSize()); }
     inline const std::vector<GoHashKey>& getHashKeyHistory() const { return hashkey_history_; }
-    inline const std::unordered_set<GoHashKey>& getHashTable() const { return hash_table_; }
 
     inline int getRotatePosition(int position, utils::Rotation rotation) const override { return utils::getPositionByRotating(rotation, position, getBoardSize()); };
     inline int getRotateAction(int action_id, utils::Rotation rotation) const override { return getRotatePosition(action_id, rotation); };
@@ -87,6 +91,9 @@ protected:
     std::vector<GoBitboard> findAreas(const GoAction& action);
     void updateBenson(const GoAction& action);
     GoBitboard findBensonBitboard(GoBitboard block_bitboard) const;
+    void updateLegalBitboard();
+    GoHashKey getNextHashKey(int position, Player player) const;
+    bool isInHashKeyHistory(GoHashKey hash_key) const;
     std::string getCoordinateString() const;
     GoBitboard floodFillBitBoard(int start_position, const GoBitboard& boundary_bitboard) const;
     GamePair<float> calculateTrompTaylorTerritory() const;
@@ -97,6 +104,7 @@ protected:
     bool checkBlockDataStructure() const;
     bool checkAreaDataStructure() const;
     bool checkBensonDataStructure() const;
+    bool checkLegalDataStructure() const;
 
     float komi_;
     GoHashKey hash_key_;
@@ -107,13 +115,14 @@ protected:
     GoBitboard free_block_id_bitboard_;
     GamePair<GoBitboard> stone_bitboard_;
     GamePair<GoBitboard> benson_bitboard_;
+    GamePair<GoBitboard> legal_bitboard_;
 
     std::vector<GoGrid> grids_;
     std::vector<GoArea> areas_;
     std::vector<GoBlock> blocks_;
     std::vector<GamePair<GoBitboard>> stone_bitboard_history_;
     std::vector<GoHashKey> hashkey_history_;
-    std::unordered_set<GoHashKey> hash_table_;
+    std::bitset<kHashKeyFilterSize> hash_key_filter_;
 };
 
 class GoEnvLoader : public BaseBoardEnvLoader<GoAction, GoEnv> {
@@ -9,6 +9,7 @@ bool GoEnv::checkDataStructure() const
     assert(checkBlockDataStructure());
     assert(checkAreaDataStructure());
     assert(checkBensonDataStructure());
+    assert(checkLegalDataStructure());
     return true;
 }
 
@@ -46,8 +47,7 @@ bool GoEnv::checkBlockDataStructure() const
     GoHashKey hash_key = actions_.size() % 2 == 0 ? 0 : getGoTurnHashKey();
     GoBitboard block_id_bitboard = ~free_block_id_bitboard_ & board_mask_bitboard_;
     while (!block_id_bitboard.none()) {
-        int id = block_id_bitboard._Find_first();
-        block_id_bitboard.reset(id);
+        int id = block_id_bitboard.popFirst();
 
         assert(id < static_cast<int>(blocks_.size()));
         const GoBlock* block = &blocks_[id];
@@ -61,8 +61,7 @@ bool GoEnv::checkBlockDataStructure() const
         GoBitboard liberty_bitboard;
         GoBitboard grid_bitboard = block->getGridBitboard();
         while (!grid_bitboard.none()) {
-            int pos = grid_bitboard._Find_first();
-            grid_bitboard.reset(pos);
+            int pos = grid_bitboard.popFirst();
 
             const GoGrid& grid = grids_[pos];
             assert(grid.getBlock() == block);
@@ -80,7 +79,7 @@ bool GoEnv::checkBlockDataStructure() const
         // areas
         GoBitboard area_id = block->getNeighborAreaIDBitboard();
         while (!area_id.none()) {
-            int id = area_id._Find_first();
+            int id = area_id.findFirst();
             area_id.reset(id);
             assert(areas_[id].getPlayer() == block->getPlayer());
             assert(!free_area_id_bitboard_.test(areas_[id].getID()));
@@ -98,21 +97,20 @@ bool GoEnv::checkAreaDataStructure() const
     GamePair<GoBitboard> area_bitboard_pair;
     GoBitboard area_id_bitboard = ~free_area_id_bitboard_ & board_mask_bitboard_;
     while (!area_id_bitboard.none()) {
-        int id = area_id_bitboard._Find_first();
-        area_id_bitboard.reset(id);
+        int id = area_id_bitboard.popFirst();
 
         assert(id < static_cast<int>(areas_.size()));
         const GoArea* area = &areas_[id];
         assert(!area->getAreaBitboard().none());
         assert(area->getNumGrid() == static_cast<int>(area->getAreaBitboard().count()));
-        assert(floodFillBitBoard(area->getAreaBitboard()._Find_first(), (~stone_bitboard_.get(area->getPlayer()) & board_mask_bitboard_)) == area->getAreaBitboard());
+        assert(floodFillBitBoard(area->getAreaBitboard().findFirst(), (~stone_bitboard_.get(area->getPlayer()) & board_mask_bitboard_)) == area->getAreaBitboard());
         assert((area->getAreaBitboard() & area_bitboard_pair.get(area->getPlayer())).none());
         area_bitboard_pair.get(area->getPlayer()) |= area->getAreaBitboard();
 
         // grids
         GoBitboard area_bitboard = area->getAreaBitboard();
         while (!area_bitboard.none()) {
-            int pos = area_bitboard._Find_first();
+            int pos = area_bitboard.findFirst();
             area_bitboard.reset(pos);
             assert(grids_[pos].getPlayer() != area->getPlayer());
             assert(grids_[pos].getArea(area->getPlayer()) == area);
@@ -121,7 +119,7 @@ bool GoEnv::checkAreaDataStructure() const
         // blocks
         GoBitboard area_neighbor_block_bitboard = dilateBitboard(area->getAreaBitboard()) & stone_bitboard_.get(area->getPlayer());
         while (!area_neighbor_block_bitboard.none()) {
-            int pos = area_neighbor_block_bitboard._Find_first();
+            int pos = area_neighbor_block_bitboard.findFirst();
             const GoBlock* block = grids_[pos].getBlock();
             assert(block);
             assert(block->getNeighborAreaIDBitboard().test(area->getID()));
@@ -143,4 +141,29 @@ bool GoEnv::checkBensonDataStructure() const
     return true;
 }
 
+bool GoEnv::checkLegalDataStructure() const
+{
+    for (const Player player : {Player::kPlayer1, Player::kPlayer2}) {
+        for (int pos = 0; pos < board_size_ * board_size_; ++pos) {
+            const GoGrid& grid = grids_[pos];
+            bool is_legal = false;
+            if (grid.getPlayer() == Player::kPlayerNone) {
+                for (const auto& neighbor_pos : grid.getNeighbors()) {
+                    const GoGrid& neighbor_grid = grids_[neighbor_pos];
+                    if (neighbor_grid.getPlayer() == Player::kPlayerNone) {
+                        is_legal = true;
+                    } else if (neighbor_grid.getPlayer() == player) {
+                        if (neighbor_grid.getBlock()->getNumLiberty() > 1) { is_legal = true; }
+                    } else {
+                        if (neighbor_grid.getBlock()->getNumLiberty() == 1) { is_legal = true; }
+                    }
+                }
+                is_legal = (is_legal && !isInHashKeyHistory(getNextHashKey(pos, player)));
+            }
+            assert(legal_bitboard_.get(player).test(pos) == is_legal);
+        }
+    }
+    return true;
+}
+
 } // namespace minizero::env::go
@@ -0,0 +1,76 @@
+#pragma once
+
+#include "go_unit.h"
+#include <cassert>
+#include <cstdint>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define GO_FEATURE_ENCODER_X86
+#endif
+
+namespace minizero::env::go {
+
+// expands the bits of a bitboard into a float plane, i.e., plane[pos] = (bitboard[pos] ? 1.0f : 0.0f) for pos in [0, plane_size)
+// the 64-bit words of the bitboard are expanded with AVX-512 mask moves or AVX2 compares when the cpu supports them
+class GoFeatureEncoder {
+public:
+    static const int kNumWords = GoBitboard::kNumWords;
+
+    static void expandBitboard(const GoBitboard& bitboard, int plane_size, float* plane)
+    {
+        assert(plane_size > 0 && plane_size <= kMaxGoBoardSize * kMaxGoBoardSize);
+        uint64_t words[kNumWords];
+        getWords(bitboard, words);
+#ifdef GO_FEATURE_ENCODER_X86
+        static const bool use_avx512 = __builtin_cpu_supports("avx512f");
+        static const bool use_avx2 = __builtin_cpu_supports("avx2");
+        if (use_avx512) {
+            expandWordsAVX512(words, plane_size, plane);
+            return;
+        } else if (use_avx2) {
+            expandWordsAVX2(words, plane_size, plane);
+            return;
+        }
+#endif
+        expandWords(words, plane_size, plane);
+    }
+
+    static void getWords(const GoBitboard& bitboard, uint64_t* words)
+    {
+        for (int i = 0; i < kNumWords; ++i) { words[i] = bitboard.getWord(i); }
+    }
+
+    static void expandWords(const uint64_t* words, int plane_size, float* plane)
+    {
+        for (int pos = 0; pos < plane_size; ++pos) { plane[pos] = ((words[pos / 64] >> (pos % 64)) & 1 ? 1.0f : 0.0f); }
+    }
+
+#ifdef GO_FEATURE_ENCODER_X86
+    // each 8 bits are broadcast to 8 lanes, and every lane keeps 1.0f if its own bit is set
+    __attribute__((target("avx2"))) static void expandWordsAVX2(const uint64_t* words, int plane_size, float* plane)
+    {
+        const __m256i lane_bits = _mm256_setr_epi32(1, 2, 4, 8, 16, 32, 64, 128);
+        const __m256 one = _mm256_set1_ps(1.0f);
+        int pos = 0;
+        for (; pos + 8 <= plane_size; pos += 8) {
+            const int bits = static_cast<int>((words[pos / 64] >> (pos % 64)) & 0xFF);
+            const __m256i mask = _mm256_cmpeq_epi32(_mm256_and_si256(_mm256_set1_epi32(bits), lane_bits), lane_bits);
+            _mm256_storeu_ps(plane + pos, _mm256_and_ps(_mm256_castsi256_ps(mask), one));
+        }
+        for (; pos < plane_size; ++pos) { plane[pos] = ((words[pos / 64] >> (pos % 64)) & 1 ? 1.0f : 0.0f); }
+    }
+
+    // each 16 bits are used directly as the mask of a zero-masking move, and the tail is stored with a masked store
+    __attribute__((target("avx512f"))) static void expandWordsAVX512(const uint64_t* words, int plane_size, float* plane)
+    {
+        const __m512 one = _mm512_set1_ps(1.0f);
+        for (int pos = 0; pos < plane_size; pos += 16) {
+            const __mmask16 bits = static_cast<__mmask16>(words[pos / 64] >> (pos % 64));
+            const __mmask16 store_mask = (plane_size - pos >= 16 ? static_cast<__mmask16>(0xFFFF) : static_cast<__mmask16>((1U << (plane_size - pos)) - 1));
+            _mm512_mask_storeu_ps(plane + pos, store_mask, _mm512_maskz_mov_ps(bits, one));
+        }
+    }
+#endif
+};
+
+} // namespace minizero::env::go
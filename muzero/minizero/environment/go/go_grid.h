@@ -7,6 +7,30 @@
 
 namespace minizero::env::go {
 
+// the neighbors of each position are shared by all grids of the same board size, so that copying grids never allocates
+inline const std::vector<int>& getGoNeighbors(int position, int board_size)
+{
+    static const std::vector<std::vector<std::vector<int>>> neighbors_table = []() {
+        const std::vector<int> directions = {0, 1, 0, -1};
+        std::vector<std::vector<std::vector<int>>> table(kMaxGoBoardSize + 1);
+        for (int size = 1; size <= kMaxGoBoardSize; ++size) {
+            table[size].resize(size * size);
+            for (int pos = 0; pos < size * size; ++pos) {
+                int x = pos % size, y = pos / size;
+                for (size_t i = 0; i < directions.size(); ++i) {
+                    int new_x = x + directions[i];
+                    int new_y = y + directions[(i + 1) % directions.size()];
+                    if (new_x < 0 || new_x >= size || new_y < 0 || new_y >= size) { continue; }
+                    table[size][pos].push_back(new_y * size + new_x);
+                }
+            }
+        }
+        return table;
+    }();
+    assert(board_size > 0 && board_size <= kMaxGoBoardSize && position >= 0 && position < board_size * board_size);
+    return neighbors_table[board_size][position];
+}
+
 class GoGrid {
 public:
     GoGrid(int position, int board_size)
@@ -20,7 +44,7 @@ public:
         player_ = Player::kPlayerNone;
         block_ = nullptr;
         area_pair_ = GamePair<GoArea*>(nullptr, nullptr);
-        initializeNeighbors(board_size);
+        neighbors_ = &getGoNeighbors(position_, board_size);
     }
 
     // setter
@@ -37,32 +61,14 @@ public:
     inline const GamePair<GoArea*>& getAreaPair() const { return area_pair_; }
     inline GoBlock* getBlock() { return block_; }
     inline const GoBlock* getBlock() const { return block_; }
-    inline const std::vector<int>& getNeighbors() const { return neighbors_; }
+    inline const std::vector<int>& getNeighbors() const { return *neighbors_; }
 
 private:
-    void initializeNeighbors(int board_size)
-    {
-        const std::vector<int> directions = {0, 1, 0, -1};
-        int x = position_ % board_size, y = position_ / board_size;
-        neighbors_.clear();
-        for (size_t i = 0; i < directions.size(); ++i) {
-            int new_x = x + directions[i];
-            int new_y = y + directions[(i + 1) % directions.size()];
-            if (!isInBoard(new_x, new_y, board_size)) { continue; }
-            neighbors_.push_back(new_y * board_size + new_x);
-        }
-    }
-
-    inline bool isInBoard(int x, int y, int board_size)
-    {
-        return (x >= 0 && x < board_size && y >= 0 && y < board_size);
-    }
-
     int position_;
     Player player_;
     GoBlock* block_;
     GamePair<GoArea*> area_pair_;
-    std::vector<int> neighbors_;
+    const std::vector<int>* neighbors_;
 };
 
 } // namespace minizero::env::go
@@ -1,6 +1,7 @@
 #pragma once
 
-#include <bitset>
+#include <cassert>
+#include <cstdint>
 #include <sstream>
 #include <string>
 
@@ -11,6 +12,142 @@ const int kGoNumPlayer = 2;
 const int kMaxGoBoardSize = 19;
 
 typedef uint64_t GoHashKey;
-typedef std::bitset<kMaxGoBoardSize * kMaxGoBoardSize> GoBitboard;
+
+// a bitboard of the largest board in 64-bit words, where position p is bit p % 64 of word p / 64
+// the bits past the last position are always zero, so that count(), none() and == never see them
+class GoBitboard {
+public:
+    static const int kNumBits = kMaxGoBoardSize * kMaxGoBoardSize;
+    static const int kNumWords = (kNumBits + 63) / 64;
+
+    GoBitboard() { reset(); }
+
+    inline void reset()
+    {
+        for (int i = 0; i < kNumWords; ++i) { words_[i] = 0; }
+    }
+    inline void set(int pos)
+    {
+        assert(pos >= 0 && pos < kNumBits);
+        words_[pos / 64] |= 1ULL << (pos % 64);
+    }
+    inline void reset(int pos)
+    {
+        assert(pos >= 0 && pos < kNumBits);
+        words_[pos / 64] &= ~(1ULL << (pos % 64));
+    }
+    inline bool test(int pos) const
+    {
+        assert(pos >= 0 && pos < kNumBits);
+        return (words_[pos / 64] >> (pos % 64)) & 1;
+    }
+
+    inline int count() const
+    {
+        int num_bits = 0;
+        for (int i = 0; i < kNumWords; ++i) { num_bits += __builtin_popcountll(words_[i]); }
+        return num_bits;
+    }
+    inline bool none() const
+    {
+        uint64_t bits = 0;
+        for (int i = 0; i < kNumWords; ++i) { bits |= words_[i]; }
+        return bits == 0;
+    }
+    inline bool any() const { return !none(); }
+
+    // returns the lowest set position, or kNumBits if no position is set
+    inline int findFirst() const
+    {
+        for (int i = 0; i < kNumWords; ++i) {
+            if (words_[i]) { return i * 64 + __builtin_ctzll(words_[i]); }
+        }
+        return kNumBits;
+    }
+
+    // clears and returns the lowest set position, which iterates over the set positions as in: while (!b.none()) { int pos = b.popFirst(); ... }
+    inline int popFirst()
+    {
+        for (int i = 0; i < kNumWords; ++i) {
+            if (words_[i]) {
+                const int pos = i * 64 + __builtin_ctzll(words_[i]);
+                words_[i] &= words_[i] - 1;
+                return pos;
+            }
+        }
+        assert(false);
+        return kNumBits;
+    }
+
+    inline uint64_t getWord(int index) const { return words_[index]; }
+
+    // grows the bitboard by one position in the four directions within one pass over the words, and clips it to board_mask
+    // the boundaries hold the leftmost and rightmost columns, which keep the stones on them from wrapping to the neighboring rows
+    inline GoBitboard dilate(int board_size, const GoBitboard& left_boundary, const GoBitboard& right_boundary, const GoBitboard& board_mask) const
+    {
+        return spread(board_size, left_boundary, right_boundary, board_mask, true);
+    }
+
+    // same as dilate(), but a position is only kept if one of its four neighbors is set
+    inline GoBitboard getNeighbors(int board_size, const GoBitboard& left_boundary, const GoBitboard& right_boundary, const GoBitboard& board_mask) const
+    {
+        return spread(board_size, left_boundary, right_boundary, board_mask, false);
+    }
+
+    inline GoBitboard& operator&=(const GoBitboard& rhs)
+    {
+        for (int i = 0; i < kNumWords; ++i) { words_[i] &= rhs.words_[i]; }
+        return *this;
+    }
+    inline GoBitboard& operator|=(const GoBitboard& rhs)
+    {
+        for (int i = 0; i < kNumWords; ++i) { words_[i] |= rhs.words_[i]; }
+        return *this;
+    }
+    inline GoBitboard& operator^=(const GoBitboard& rhs)
+    {
+        for (int i = 0; i < kNumWords; ++i) { words_[i] ^= rhs.words_[i]; }
+        return *this;
+    }
+    inline GoBitboard operator~() const
+    {
+        GoBitboard result;
+        for (int i = 0; i < kNumWords; ++i) { result.words_[i] = ~words_[i]; }
+        result.words_[kNumWords - 1] &= kLastWordMask;
+        return result;
+    }
+    inline GoBitboard operator&(const GoBitboard& rhs) const { return GoBitboard(*this) &= rhs; }
+    inline GoBitboard operator|(const GoBitboard& rhs) const { return GoBitboard(*this) |= rhs; }
+    inline GoBitboard operator^(const GoBitboard& rhs) const { return GoBitboard(*this) ^= rhs; }
+    inline bool operator==(const GoBitboard& rhs) const
+    {
+        uint64_t diff = 0;
+        for (int i = 0; i < kNumWords; ++i) { diff |= words_[i] ^ rhs.words_[i]; }
+        return diff == 0;
+    }
+    inline bool operator!=(const GoBitboard& rhs) const { return !(*this == rhs); }
+
+private:
+    inline GoBitboard spread(int board_size, const GoBitboard& left_boundary, const GoBitboard& right_boundary, const GoBitboard& board_mask, bool keep_self) const
+    {
+        assert(board_size > 0 && board_size < 64);
+        GoBitboard result;
+        for (int i = 0; i < kNumWords; ++i) {
+            const uint64_t word = words_[i];
+            const uint64_t prev_word = (i > 0 ? words_[i - 1] : 0);
+            const uint64_t next_word = (i + 1 < kNumWords ? words_[i + 1] : 0);
+            const uint64_t up = (word << board_size) | (prev_word >> (64 - board_size));
+            const uint64_t down = (word >> board_size) | (next_word << (64 - board_size));
+            const uint64_t left = ((word & ~left_boundary.words_[i]) >> 1) | (i + 1 < kNumWords ? (next_word & ~left_boundary.words_[i + 1]) << 63 : 0);
+            const uint64_t right = ((word & ~right_boundary.words_[i]) << 1) | (i > 0 ? (prev_word & ~right_boundary.words_[i - 1]) >> 63 : 0);
+            result.words_[i] = ((keep_self ? word : 0) | up | down | left | right) & board_mask.words_[i];
+        }
+        return result;
+    }
+
+    static const uint64_t kLastWordMask = (kNumBits % 64 == 0 ? ~0ULL : (1ULL << (kNumBits % 64)) - 1);
+
+    uint64_t words_[kNumWords];
+};
 
 } // namespace minizero::env::go
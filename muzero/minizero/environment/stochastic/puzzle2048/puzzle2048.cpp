@@ -110,10 +110,11 @@ bool Puzzle2048Env::isTerminal() const
 std::vector<float> Puzzle2048Env::getFeatures(utils::Rotation rotation /*= utils::Rotation::kRotationNone*/) const
 {
     // 16 channels: the nth channel represents the position of the nth tile
+    const int* rotation_positions = utils::getRotationTable(rotation, kPuzzle2048BoardSize);
     std::vector<float> features;
     for (int tile = 0; tile < 16; ++tile) {
         for (int pos = 0; pos < 16; ++pos) {
-            features.push_back(board_.get(getRotatePosition(pos, rotation)) == tile ? 1.0f : 0.0f);
+            features.push_back(board_.get(rotation_positions[pos]) == tile ? 1.0f : 0.0f);
         }
     }
     return features;
@@ -201,7 +202,14 @@ float Puzzle2048EnvLoader::calculateNStepValue(const int pos) const
 
 std::vector<float> Puzzle2048EnvLoader::toDiscreteValue(float value) const
 {
-    std::vector<float> discrete_value(kPuzzle2048DiscreteValueSize, 0.0f);
+    std::vector<float> discrete_value(kPuzzle2048DiscreteValueSize);
+    toDiscreteValue(value, discrete_value.data());
+    return discrete_value;
+}
+
+void Puzzle2048EnvLoader::toDiscreteValue(float value, float* discrete_value) const
+{
+    std::fill(discrete_value, discrete_value + kPuzzle2048DiscreteValueSize, 0.0f);
     int value_floor = floor(value);
     int value_ceil = ceil(value);
     int shift = kPuzzle2048DiscreteValueSize / 2;
@@ -213,7 +221,6 @@ std::vector<float> Puzzle2048EnvLoader::toDiscreteValue(float value) const
         discrete_value[value_floor_shift] = value_ceil - value;
         discrete_value[value_ceil_shift] = value - value_floor;
     }
-    return discrete_value;
 }
 
 } // namespace minizero::env::puzzle2048
@@ -87,6 +87,8 @@ public:
     std::vector<float> getActionFeatures(const int pos, utils::Rotation rotation = utils::Rotation::kRotationNone) const override { return Puzzle2048Env().getActionFeatures(pos < static_cast<int>(action_pairs_.size()) ? action_pairs_[pos].first : Puzzle2048Action(), rotation); }
     std::vector<float> getValue(const int pos) const override { return toDiscreteValue(pos < static_cast<int>(action_pairs_.size()) ? utils::transformValue(calculateNStepValue(pos)) : 0.0f); }
     std::vector<float> getReward(const int pos) const override { return toDiscreteValue(pos < static_cast<int>(action_pairs_.size()) ? utils::transformValue(BaseEnvLoader::getReward(pos)[0]) : 0.0f); }
+    void writeValue(const int pos, float* value) const override { toDiscreteValue(pos < static_cast<int>(action_pairs_.size()) ? utils::transformValue(calculateNStepValue(pos)) : 0.0f, value); }
+    void writeReward(const int pos, float* reward) const override { toDiscreteValue(pos < static_cast<int>(action_pairs_.size()) ? utils::transformValue(BaseEnvLoader::getReward(pos)[0]) : 0.0f, reward); }
     float getPriority(const int pos) const override { return fabs(calculateNStepValue(pos) - BaseEnvLoader::getValue(pos)[0]); }
 
     std::string name() const override { return kPuzzle2048Name; }
@@ -94,9 +96,13 @@ public:
     int getRotatePosition(int position, utils::Rotation rotation) const override { return utils::getPositionByRotating(rotation, position, kPuzzle2048BoardSize); }
     int getRotateAction(int action_id, utils::Rotation rotation) const override { return Puzzle2048Env().getRotateAction(action_id, rotation); }
 
+protected:
+    void rotateFeatures(const float* features, int feature_size, utils::Rotation rotation, float* rotated_features) const override { rotateFeaturePlanes(features, feature_size, kPuzzle2048BoardSize * kPuzzle2048BoardSize, rotation, rotated_features); }
+
 private:
     float calculateNStepValue(const int pos) const;
     std::vector<float> toDiscreteValue(float value) const;
+    void toDiscreteValue(float value, float* discrete_value) const;
 };
 
 } // namespace minizero::env::puzzle2048
@@ -39,6 +39,10 @@ template <class Action, class Env>
 class StochasticEnvLoader : public BaseEnvLoader<Action, Env> {
 public:
     StochasticEnvLoader() : BaseEnvLoader<Action, Env>() {}
+    StochasticEnvLoader(const StochasticEnvLoader&) = default;
+    StochasticEnvLoader(StochasticEnvLoader&&) = default;
+    StochasticEnvLoader& operator=(const StochasticEnvLoader&) = default;
+    StochasticEnvLoader& operator=(StochasticEnvLoader&&) = default;
     virtual ~StochasticEnvLoader() = default;
 
     void loadFromEnvironment(const Env& env, const std::vector<std::vector<std::pair<std::string, std::string>>>& action_info_history = {}) override
@@ -49,15 +53,8 @@ public:
 
     inline int getSeed() const { return std::stoi(BaseEnvLoader<Action, Env>::getTag("SD")); }
 
-    std::vector<float> getFeatures(const int pos, utils::Rotation rotation = utils::Rotation::kRotationNone) const override
-    {
-        // a slow but naive method which simply replays the game again to get features
-        Env env;
-        env.reset(getSeed());
-        const auto& action_pairs_ = BaseEnvLoader<Action, Env>::action_pairs_;
-        for (int i = 0; i < std::min(pos, static_cast<int>(action_pairs_.size())); ++i) { env.act(action_pairs_[i].first); }
-        return env.getFeatures(rotation);
-    }
+protected:
+    void initializeReplayEnv(Env& env) const override { env.reset(getSeed()); }
 };
 
 } // namespace minizero::env
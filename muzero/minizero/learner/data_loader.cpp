@@ -5,6 +5,9 @@
 #include "rotation.h"
 #include <algorithm>
 #include <fstream>
+#include <iterator>
+#include <iostream>
+#include <numeric>
 #include <utility>
 
 namespace minizero::learner {
@@ -15,79 +18,92 @@ using namespace minizero::utils;
 ReplayBuffer::ReplayBuffer()
 {
     num_data_ = 0;
-    game_priority_sum_ = 0.0f;
-    game_priorities_.clear();
+    feature_cache_bytes_ = 0;
+    first_game_slot_ = 0;
+    game_priorities_.reset(0);
     position_priorities_.clear();
     env_loaders_.clear();
 }
 
-void ReplayBuffer::addData(const EnvironmentLoader& env_loader)
+void ReplayBuffer::addData(EnvironmentLoader&& env_loader)
 {
     std::pair<int, int> data_range = env_loader.getDataRange();
-    std::deque<float> position_priorities(data_range.second + 1, 0.0f);
-    float game_priority = 0.0f;
+    SumTree position_priorities(data_range.second + 1);
     for (int i = data_range.first; i <= data_range.second; ++i) {
-        position_priorities[i] = std::pow((config::learner_use_per ? env_loader.getPriority(i) : 1.0f), config::learner_per_alpha);
-        game_priority += position_priorities[i];
+        position_priorities.set(i, std::pow((config::learner_use_per ? env_loader.getPriority(i) : 1.0f), config::learner_per_alpha));
     }
 
     std::lock_guard<std::mutex> lock(mutex_);
 
     // add new data to replay buffer
     num_data_ += (data_range.second - data_range.first + 1);
-    position_priorities_.push_back(position_priorities);
-    game_priorities_.push_back(game_priority);
-    env_loaders_.push_back(env_loader);
+    if (static_cast<int>(position_priorities_.size()) == game_priorities_.size()) { growGamePriorities(); }
+    game_priorities_.set(getGameSlot(position_priorities_.size()), position_priorities.getTotal());
+    position_priorities_.push_back(std::move(position_priorities));
+    feature_cache_bytes_ += env_loader.getFeatureCacheBytes();
+    env_loaders_.push_back(std::move(env_loader));
 
     // remove old data if replay buffer is full
     const size_t replay_buffer_max_size = config::zero_replay_buffer * config::zero_num_games_per_iteration;
     while (position_priorities_.size() > replay_buffer_max_size) {
         data_range = env_loaders_.front().getDataRange();
         num_data_ -= (data_range.second - data_range.first + 1);
+        feature_cache_bytes_ -= env_loaders_.front().getFeatureCacheBytes();
+        game_priorities_.set(first_game_slot_, 0.0);
+        first_game_slot_ = (first_game_slot_ + 1) % game_priorities_.size();
         position_priorities_.pop_front();
-        game_priorities_.pop_front();
         env_loaders_.pop_front();
     }
+
+    // keep the cached features within the budget, games without cached features are replayed when sampled
+    if (!env_loaders_.empty() && !hasFeatureCacheBudget()) {
+        feature_cache_bytes_ -= env_loaders_.back().getFeatureCacheBytes();
+        env_loaders_.back().clearFeatureCache();
+    }
 }
 
-std::pair<int, int> ReplayBuffer::sampleEnvAndPos()
+bool ReplayBuffer::hasFeatureCacheBudget()
 {
-    int env_id = sampleIndex(game_priorities_);
-    int pos_id = sampleIndex(position_priorities_[env_id]);
-    return {env_id, pos_id};
+    return feature_cache_bytes_ <= static_cast<size_t>(config::learner_feature_cache_mb) * 1024 * 1024;
 }
 
-int ReplayBuffer::sampleIndex(const std::deque<float>& weight)
+std::pair<int, int> ReplayBuffer::sampleEnvAndPos() const
 {
-    std::discrete_distribution<> dis(weight.begin(), weight.end());
-    return dis(Random::generator_);
+    const int game_slot = game_priorities_.sample(Random::randReal(game_priorities_.getTotal()));
+    const int env_id = (game_slot - first_game_slot_ + game_priorities_.size()) % game_priorities_.size();
+    const SumTree& position_priorities = position_priorities_[env_id];
+    const int pos_id = position_priorities.sample(Random::randReal(position_priorities.getTotal()));
+    return {env_id, pos_id};
 }
 
-float ReplayBuffer::getLossScale(const std::pair<int, int>& p)
+float ReplayBuffer::getLossScale(const std::pair<int, int>& p) const
 {
     if (!config::learner_use_per) { return 1.0f; }
 
     // calculate importance sampling ratio
     int env_id = p.first, pos = p.second;
-    float prob = position_priorities_[env_id][pos] / game_priority_sum_;
+    float prob = position_priorities_[env_id].get(pos) / game_priorities_.getTotal();
     return std::pow((num_data_ * prob), (-config::learner_per_init_beta));
 }
 
-std::string DataLoaderSharedData::getNextEnvString()
+void ReplayBuffer::setPositionPriority(int env_id, int pos_id, float priority)
 {
-    std::lock_guard<std::mutex> lock(mutex_);
-    std::string env_string = "";
-    if (!env_strings_.empty()) {
-        env_string = env_strings_.front();
-        env_strings_.pop_front();
-    }
-    return env_string;
+    SumTree& position_priorities = position_priorities_[env_id];
+    if (pos_id < position_priorities.size()) { position_priorities.set(pos_id, priority); }
 }
 
-int DataLoaderSharedData::getNextBatchIndex()
+void ReplayBuffer::updateGamePriority(int env_id)
 {
-    std::lock_guard<std::mutex> lock(mutex_);
-    return (batch_index_ < config::learner_batch_size ? batch_index_++ : config::learner_batch_size);
+    game_priorities_.set(getGameSlot(env_id), position_priorities_[env_id].getTotal());
+}
+
+void ReplayBuffer::growGamePriorities()
+{
+    // rebuild the ring with twice the slots, starting from the oldest game
+    SumTree game_priorities(std::max(1, 2 * game_priorities_.size()));
+    for (size_t env_id = 0; env_id < position_priorities_.size(); ++env_id) { game_priorities.set(env_id, position_priorities_[env_id].getTotal()); }
+    game_priorities_ = std::move(game_priorities);
+    first_game_slot_ = 0;
 }
 
 void DataLoaderThread::initialize()
@@ -98,37 +114,78 @@ void DataLoaderThread::initialize()
 
 void DataLoaderThread::runJob()
 {
-    if (!getSharedData()->env_strings_.empty()) {
-        while (addEnvironmentLoader()) {}
-    } else {
-        while (sampleData()) {}
+    const DataLoaderJob job = getSharedData()->job_;
+    int begin, end;
+    while (getSharedData()->index_range_.next(id_, begin, end)) {
+        for (int index = begin; index < end; ++index) {
+            if (job == DataLoaderJob::kLoadData) {
+                addEnvironmentLoader(index);
+            } else if (job == DataLoaderJob::kLoadRecord) {
+                addEnvironmentLoaderFromRecord(index);
+            } else if (job == DataLoaderJob::kSampleData) {
+                sampleData(index);
+            } else if (job == DataLoaderJob::kUpdatePriority) {
+                updatePriority(index);
+            }
+        }
     }
 }
 
-bool DataLoaderThread::addEnvironmentLoader()
+void DataLoaderThread::addEnvironmentLoader(int env_string_index)
 {
-    std::string env_string = getSharedData()->getNextEnvString();
-    if (env_string.empty()) { return false; }
+    EnvironmentLoader env_loader;
+    env_loader.setArena(getSharedData()->arena_);
+    if (!env_loader.loadFromString(getSharedData()->env_strings_[env_string_index])) { return; }
+    addToReplayBuffer(std::move(env_loader));
+}
 
+void DataLoaderThread::addEnvironmentLoaderFromRecord(int record_index)
+{
     EnvironmentLoader env_loader;
-    if (env_loader.loadFromString(env_string)) { getSharedData()->replay_buffer_.addData(env_loader); }
-    return true;
+    env_loader.setArena(getSharedData()->arena_);
+    std::pair<const char*, size_t> record = getSharedData()->record_file_.getRecord(record_index);
+    if (!env_loader.loadFromBinary(record.first, record.second)) { return; }
+    addToReplayBuffer(std::move(env_loader));
 }
 
-bool DataLoaderThread::sampleData()
+void DataLoaderThread::addToReplayBuffer(EnvironmentLoader&& env_loader)
 {
-    int batch_index = getSharedData()->getNextBatchIndex();
-    if (batch_index >= config::learner_batch_size) { return false; }
+    // replay the game once here instead of for every sampled position; a racy budget check only decides whether to try
+    ReplayBuffer& replay_buffer = getSharedData()->replay_buffer_;
+    if (replay_buffer.hasFeatureCacheBudget()) { env_loader.cacheFeatures(env_loader.getDataRange().first, env_loader.getDataRange().second); }
+    replay_buffer.addData(std::move(env_loader));
+}
 
+void DataLoaderThread::sampleData(int batch_index)
+{
     if (config::nn_type_name == "alphazero") {
         setAlphaZeroTrainingData(batch_index);
     } else if (config::nn_type_name == "muzero") {
         setMuZeroTrainingData(batch_index);
-    } else {
-        return false; // should not be here
     }
+}
 
-    return true;
+void DataLoaderThread::updatePriority(int group_index)
+{
+    // a group holds every batch entry of one game, so no other thread touches the game meanwhile
+    std::shared_ptr<DataLoaderSharedData> shared_data = getSharedData();
+    const int group_begin = shared_data->priority_group_begins_[group_index];
+    const int group_end = shared_data->priority_group_begins_[group_index + 1];
+    const int env_id = shared_data->sampled_index_[2 * shared_data->priority_batch_indices_[group_begin]];
+    EnvironmentLoader& env_loader = shared_data->replay_buffer_.env_loaders_[env_id];
+
+    // update all values before the priorities, since n-step priorities read the values of later positions
+    for (int i = group_begin; i < group_end; ++i) {
+        const int batch_index = shared_data->priority_batch_indices_[i];
+        const int pos_id = shared_data->sampled_index_[2 * batch_index + 1];
+        for (int step = 0; step <= config::learner_muzero_unrolling_step; ++step) {
+            env_loader.setValue(pos_id + step, utils::invertValue(shared_data->batch_values_[step * config::learner_batch_size + batch_index]));
+        }
+    }
+    for (int i = group_begin; i < group_end; ++i) {
+        const int pos_id = shared_data->sampled_index_[2 * shared_data->priority_batch_indices_[i] + 1];
+        shared_data->replay_buffer_.setPositionPriority(env_id, pos_id, std::pow(env_loader.getPriority(pos_id), config::learner_per_alpha));
+    }
 }
 
 void DataLoaderThread::setAlphaZeroTrainingData(int batch_index)
@@ -141,17 +198,16 @@ void DataLoaderThread::setAlphaZeroTrainingData(int batch_index)
     const EnvironmentLoader& env_loader = getSharedData()->replay_buffer_.env_loaders_[env_id];
     Rotation rotation = static_cast<Rotation>(Random::randInt() % static_cast<int>(Rotation::kRotateSize));
     float loss_scale = getSharedData()->replay_buffer_.getLossScale(p);
-    std::vector<float> features = env_loader.getFeatures(pos, rotation);
-    std::vector<float> policy = env_loader.getPolicy(pos, rotation);
-    std::vector<float> value = env_loader.getValue(pos);
 
     // write data to data_ptr
-    getSharedData()->getDataPtr()->loss_scale_[batch_index] = loss_scale;
-    getSharedData()->getDataPtr()->sampled_index_[2 * batch_index] = p.first;
-    getSharedData()->getDataPtr()->sampled_index_[2 * batch_index + 1] = p.second;
-    std::copy(features.begin(), features.end(), getSharedData()->getDataPtr()->features_ + features.size() * batch_index);
-    std::copy(policy.begin(), policy.end(), getSharedData()->getDataPtr()->policy_ + policy.size() * batch_index);
-    std::copy(value.begin(), value.end(), getSharedData()->getDataPtr()->value_ + value.size() * batch_index);
+    std::shared_ptr<DataLoaderSharedData> shared_data = getSharedData();
+    std::shared_ptr<BatchDataPtr> data_ptr = shared_data->getDataPtr();
+    data_ptr->loss_scale_[batch_index] = loss_scale;
+    data_ptr->sampled_index_[2 * batch_index] = p.first;
+    data_ptr->sampled_index_[2 * batch_index + 1] = p.second;
+    env_loader.writeFeatures(pos, rotation, data_ptr->features_ + shared_data->feature_size_ * batch_index);
+    env_loader.writePolicy(pos, rotation, data_ptr->policy_ + shared_data->policy_size_ * batch_index);
+    env_loader.writeValue(pos, data_ptr->value_ + shared_data->value_size_ * batch_index);
 }
 
 void DataLoaderThread::setMuZeroTrainingData(int batch_index)
@@ -164,39 +220,25 @@ void DataLoaderThread::setMuZeroTrainingData(int batch_index)
     const EnvironmentLoader& env_loader = getSharedData()->replay_buffer_.env_loaders_[env_id];
     Rotation rotation = static_cast<Rotation>(Random::randInt() % static_cast<int>(Rotation::kRotateSize));
     float loss_scale = getSharedData()->replay_buffer_.getLossScale(p);
-    std::vector<float> features = env_loader.getFeatures(pos, rotation);
-    std::vector<float> action_features, policy, value, reward, tmp;
-    for (int step = 0; step <= config::learner_muzero_unrolling_step; ++step) {
-        // action features
-        if (step < config::learner_muzero_unrolling_step) {
-            tmp = env_loader.getActionFeatures(pos + step, rotation);
-            action_features.insert(action_features.end(), tmp.begin(), tmp.end());
-        }
 
-        // policy
-        tmp = env_loader.getPolicy(pos + step, rotation);
-        policy.insert(policy.end(), tmp.begin(), tmp.end());
-
-        // value
-        tmp = env_loader.getValue(pos + step);
-        value.insert(value.end(), tmp.begin(), tmp.end());
-
-        // reward
-        if (step < config::learner_muzero_unrolling_step) {
-            tmp = env_loader.getReward(pos + step);
-            reward.insert(reward.end(), tmp.begin(), tmp.end());
-        }
+    // write data to data_ptr, each unrolling step goes straight to its slice of the batch
+    std::shared_ptr<DataLoaderSharedData> shared_data = getSharedData();
+    std::shared_ptr<BatchDataPtr> data_ptr = shared_data->getDataPtr();
+    const int unrolling_step = config::learner_muzero_unrolling_step;
+    data_ptr->loss_scale_[batch_index] = loss_scale;
+    data_ptr->sampled_index_[2 * batch_index] = p.first;
+    data_ptr->sampled_index_[2 * batch_index + 1] = p.second;
+    env_loader.writeFeatures(pos, rotation, data_ptr->features_ + shared_data->feature_size_ * batch_index);
+    for (int step = 0; step <= unrolling_step; ++step) {
+        const int unrolled_index = batch_index * (unrolling_step + 1) + step;
+        env_loader.writePolicy(pos + step, rotation, data_ptr->policy_ + shared_data->policy_size_ * unrolled_index);
+        env_loader.writeValue(pos + step, data_ptr->value_ + shared_data->value_size_ * unrolled_index);
+        if (step == unrolling_step) { break; }
+
+        const int transition_index = batch_index * unrolling_step + step;
+        env_loader.writeActionFeatures(pos + step, rotation, data_ptr->action_features_ + shared_data->action_feature_size_ * transition_index);
+        env_loader.writeReward(pos + step, data_ptr->reward_ + shared_data->value_size_ * transition_index);
     }
-
-    // write data to data_ptr
-    getSharedData()->getDataPtr()->loss_scale_[batch_index] = loss_scale;
-    getSharedData()->getDataPtr()->sampled_index_[2 * batch_index] = p.first;
-    getSharedData()->getDataPtr()->sampled_index_[2 * batch_index + 1] = p.second;
-    std::copy(features.begin(), features.end(), getSharedData()->getDataPtr()->features_ + features.size() * batch_index);
-    std::copy(action_features.begin(), action_features.end(), getSharedData()->getDataPtr()->action_features_ + action_features.size() * batch_index);
-    std::copy(policy.begin(), policy.end(), getSharedData()->getDataPtr()->policy_ + policy.size() * batch_index);
-    std::copy(value.begin(), value.end(), getSharedData()->getDataPtr()->value_ + value.size() * batch_index);
-    std::copy(reward.begin(), reward.end(), getSharedData()->getDataPtr()->reward_ + reward.size() * batch_index);
 }
 
 DataLoader::DataLoader(const std::string& conf_file_name)
@@ -210,46 +252,101 @@ DataLoader::DataLoader(const std::string& conf_file_name)
 void DataLoader::initialize()
 {
     createSlaveThreads(config::learner_num_thread);
+    getSharedData()->index_range_.reset(config::learner_num_thread);
     getSharedData()->createDataPtr();
+
+    // the action features take the size the environment encodes, which is not always a full hidden plane, e.g., in 2048
+    Environment env;
+    env.reset();
+    getSharedData()->feature_size_ = env.getNumInputChannels() * env.getInputChannelHeight() * env.getInputChannelWidth();
+    getSharedData()->action_feature_size_ = env.getActionFeatures(env.getLegalActions()[0]).size();
+    getSharedData()->policy_size_ = env.getPolicySize();
+    getSharedData()->value_size_ = env.getDiscreteValueSize();
 }
 
 void DataLoader::loadDataFromFile(const std::string& file_name)
 {
-    std::ifstream fin(file_name, std::ifstream::in);
-    for (std::string content; std::getline(fin, content);) { getSharedData()->env_strings_.push_back(content); }
+    // record files are mapped and decoded in place, while sgf files are read line by line
+    if (RecordFileReader::isRecordFile(file_name)) {
+        if (!getSharedData()->record_file_.open(file_name)) {
+            std::cerr << "Failed to open record file " << file_name << std::endl;
+            return;
+        }
+        runLoadJob(file_name, DataLoaderJob::kLoadRecord, getSharedData()->record_file_.getNumRecords());
+        getSharedData()->record_file_.close();
+        return;
+    }
+
+    // only read the complete lines after the last loaded one, a line without its newline is still being written
+    std::ifstream fin(file_name, std::ifstream::in | std::ifstream::binary);
+    if (!fin) { return; }
+    std::streamoff& offset = file_offsets_[file_name];
+    fin.seekg(0, std::ios::end);
+    if (fin.tellg() < offset) { offset = 0; } // the file is rewritten, e.g., the iteration restarts
+    fin.seekg(offset);
+    for (std::string content; std::getline(fin, content) && !fin.eof();) {
+        offset = fin.tellg();
+        if (!content.empty()) { getSharedData()->env_strings_.push_back(content); }
+    }
 
-    for (auto& t : slave_threads_) { t->start(); }
-    for (auto& t : slave_threads_) { t->finish(); }
-    getSharedData()->replay_buffer_.game_priority_sum_ = std::accumulate(getSharedData()->replay_buffer_.game_priorities_.begin(), getSharedData()->replay_buffer_.game_priorities_.end(), 0.0f);
+    runLoadJob(file_name, DataLoaderJob::kLoadData, getSharedData()->env_strings_.size());
+    getSharedData()->env_strings_.clear();
+}
+
+void DataLoader::finishFile(const std::string& file_name)
+{
+    // the file is not loaded again, so its games keep the arena alive on their own
+    file_offsets_.erase(file_name);
+    file_arenas_.erase(file_name);
+}
+
+void DataLoader::runLoadJob(const std::string& file_name, DataLoaderJob job, int num_jobs)
+{
+    // reuse the arena of a file loaded incrementally, as long as some of its games are still in the replay buffer
+    for (auto it = file_arenas_.begin(); it != file_arenas_.end();) { it = (it->second.expired() ? file_arenas_.erase(it) : std::next(it)); }
+    std::shared_ptr<Arena> arena = file_arenas_[file_name].lock();
+    if (!arena) {
+        arena = std::make_shared<Arena>();
+        file_arenas_[file_name] = arena;
+    }
+
+    getSharedData()->job_ = job;
+    getSharedData()->arena_ = arena;
+    getSharedData()->index_range_.assign(0, num_jobs);
+    runSlaveThreads();
+    getSharedData()->arena_.reset();
 }
 
 void DataLoader::sampleData()
 {
-    getSharedData()->batch_index_ = 0;
-    for (auto& t : slave_threads_) { t->start(); }
-    for (auto& t : slave_threads_) { t->finish(); }
+    getSharedData()->job_ = DataLoaderJob::kSampleData;
+    getSharedData()->index_range_.assign(0, config::learner_batch_size);
+    runSlaveThreads();
 }
 
 void DataLoader::updatePriority(int* sampled_index, float* batch_values)
 {
-    // TODO: use multiple threads
-    for (int batch_index = 0; batch_index < config::learner_batch_size; ++batch_index) {
-        int env_id = sampled_index[2 * batch_index];
-        int pos_id = sampled_index[2 * batch_index + 1];
-
-        EnvironmentLoader& env_loader = getSharedData()->replay_buffer_.env_loaders_[env_id];
-        for (int step = 0; step <= config::learner_muzero_unrolling_step; ++step) {
-            float new_value = utils::invertValue(batch_values[step * config::learner_batch_size + batch_index]);
-            env_loader.setActionPairInfo(pos_id + step, "V", std::to_string(new_value));
-        }
-        getSharedData()->replay_buffer_.position_priorities_[env_id][pos_id] = std::pow(env_loader.getPriority(pos_id), config::learner_per_alpha);
+    // group the batch entries by game, so that the threads update disjoint games
+    std::shared_ptr<DataLoaderSharedData> shared_data = getSharedData();
+    std::vector<int>& batch_indices = shared_data->priority_batch_indices_;
+    batch_indices.resize(config::learner_batch_size);
+    std::iota(batch_indices.begin(), batch_indices.end(), 0);
+    std::stable_sort(batch_indices.begin(), batch_indices.end(), [sampled_index](int lhs, int rhs) { return sampled_index[2 * lhs] < sampled_index[2 * rhs]; });
+    std::vector<int>& group_begins = shared_data->priority_group_begins_;
+    group_begins.clear();
+    for (int i = 0; i < config::learner_batch_size; ++i) {
+        if (i == 0 || sampled_index[2 * batch_indices[i]] != sampled_index[2 * batch_indices[i - 1]]) { group_begins.push_back(i); }
     }
+    const int num_groups = group_begins.size();
+    group_begins.push_back(config::learner_batch_size);
 
-    // recalculate priority to correct floating number error (TODO: speedup this)
-    for (size_t i = 0; i < getSharedData()->replay_buffer_.game_priorities_.size(); ++i) {
-        getSharedData()->replay_buffer_.game_priorities_[i] = std::accumulate(getSharedData()->replay_buffer_.position_priorities_[i].begin(), getSharedData()->replay_buffer_.position_priorities_[i].end(), 0.0f);
-    }
-    getSharedData()->replay_buffer_.game_priority_sum_ = std::accumulate(getSharedData()->replay_buffer_.game_priorities_.begin(), getSharedData()->replay_buffer_.game_priorities_.end(), 0.0f);
+    shared_data->job_ = DataLoaderJob::kUpdatePriority;
+    shared_data->sampled_index_ = sampled_index;
+    shared_data->batch_values_ = batch_values;
+    shared_data->index_range_.assign(0, num_groups);
+    runSlaveThreads();
+
+    for (int group_index = 0; group_index < num_groups; ++group_index) { shared_data->replay_buffer_.updateGamePriority(sampled_index[2 * batch_indices[group_begins[group_index]]]); }
 }
 
 } // namespace minizero::learner
@@ -1,8 +1,15 @@
 #pragma once
 
+#include "arena_allocator.h"
 #include "environment.h"
 #include "paralleler.h"
+#include "record_file.h"
+#include "sum_tree.h"
+#include "work_stealing_range.h"
+#include <atomic>
 #include <deque>
+#include <ios>
+#include <map>
 #include <memory>
 #include <mutex>
 #include <string>
@@ -37,30 +44,58 @@ public:
 
     std::mutex mutex_;
     int num_data_;
-    float game_priority_sum_;
-    std::deque<float> game_priorities_;
-    std::deque<std::deque<float>> position_priorities_;
+    std::atomic<size_t> feature_cache_bytes_;
     std::deque<EnvironmentLoader> env_loaders_;
 
-    void addData(const EnvironmentLoader& env_loader);
-    std::pair<int, int> sampleEnvAndPos();
-    int sampleIndex(const std::deque<float>& weight);
-    float getLossScale(const std::pair<int, int>& p);
+    void addData(EnvironmentLoader&& env_loader);
+    bool hasFeatureCacheBudget();
+    std::pair<int, int> sampleEnvAndPos() const;
+    float getLossScale(const std::pair<int, int>& p) const;
+    // position priorities of different games can be set concurrently, while the game priorities are updated afterwards in one thread
+    void setPositionPriority(int env_id, int pos_id, float priority);
+    void updateGamePriority(int env_id);
+
+private:
+    void growGamePriorities();
+    inline int getGameSlot(int env_id) const { return (first_game_slot_ + env_id) % game_priorities_.size(); }
+
+    // the games form a ring in the leaves of game_priorities_, where each leaf holds the total priority of one game
+    int first_game_slot_;
+    SumTree game_priorities_;
+    std::deque<SumTree> position_priorities_;
+};
+
+enum class DataLoaderJob {
+    kLoadData,
+    kLoadRecord,
+    kSampleData,
+    kUpdatePriority
 };
 
 class DataLoaderSharedData : public utils::BaseSharedData {
 public:
-    std::string getNextEnvString();
-    int getNextBatchIndex();
-
     virtual void createDataPtr() { data_ptr_ = std::make_shared<BatchDataPtr>(); }
     inline std::shared_ptr<BatchDataPtr> getDataPtr() { return std::static_pointer_cast<BatchDataPtr>(data_ptr_); }
 
-    int batch_index_;
+    DataLoaderJob job_;
     ReplayBuffer replay_buffer_;
-    std::mutex mutex_;
-    std::deque<std::string> env_strings_;
+    utils::WorkStealingRange index_range_;
+    std::vector<std::string> env_strings_;
+    utils::RecordFileReader record_file_;
+    std::shared_ptr<utils::Arena> arena_;
     std::shared_ptr<BaseBatchDataPtr> data_ptr_;
+
+    // the number of floats of each kind of training data per position, which are the strides of the batch data
+    int feature_size_;
+    int action_feature_size_;
+    int policy_size_;
+    int value_size_;
+
+    // the batch entries of a priority update grouped by game, where group i is [priority_group_begins_[i], priority_group_begins_[i + 1])
+    int* sampled_index_;
+    float* batch_values_;
+    std::vector<int> priority_batch_indices_;
+    std::vector<int> priority_group_begins_;
 };
 
 class DataLoaderThread : public utils::BaseSlaveThread {
@@ -73,8 +108,11 @@ public:
     bool isDone() override { return false; }
 
 protected:
-    virtual bool addEnvironmentLoader();
-    virtual bool sampleData();
+    virtual void addEnvironmentLoader(int env_string_index);
+    virtual void addEnvironmentLoaderFromRecord(int record_index);
+    virtual void addToReplayBuffer(EnvironmentLoader&& env_loader);
+    virtual void sampleData(int batch_index);
+    virtual void updatePriority(int group_index);
 
     virtual void setAlphaZeroTrainingData(int batch_index);
     virtual void setMuZeroTrainingData(int batch_index);
@@ -89,12 +127,22 @@ public:
     void initialize() override;
     void summarize() override {}
     virtual void loadDataFromFile(const std::string& file_name);
+    virtual void finishFile(const std::string& file_name);
     virtual void sampleData();
     virtual void updatePriority(int* sampled_index, float* batch_values);
 
     void createSharedData() override { shared_data_ = std::make_shared<DataLoaderSharedData>(); }
     std::shared_ptr<utils::BaseSlaveThread> newSlaveThread(int id) override { return std::make_shared<DataLoaderThread>(id, shared_data_); }
     inline std::shared_ptr<DataLoaderSharedData> getSharedData() { return std::static_pointer_cast<DataLoaderSharedData>(shared_data_); }
+
+protected:
+    void runLoadJob(const std::string& file_name, DataLoaderJob job, int num_jobs);
+
+    // the bytes of each sgf file already loaded, so that loading a file again only adds the games appended since;
+    // the entries of a file are dropped by finishFile once it is completely loaded or leaves the replay window
+    std::map<std::string, std::streamoff> file_offsets_;
+    // the games of one file share an arena, which is released once all of them are evicted from the replay buffer
+    std::map<std::string, std::weak_ptr<utils::Arena>> file_arenas_;
 };
 
 } // namespace minizero::learner
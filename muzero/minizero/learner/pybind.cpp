@@ -36,6 +36,7 @@ PYBIND11_MODULE(minizero_py, m)
     m.def("use_gumbel", []() { return config::actor_use_gumbel; });
     m.def("get_zero_replay_buffer", []() { return config::zero_replay_buffer; });
     m.def("use_per", []() { return config::learner_use_per; });
+    m.def("get_tail_interval", []() { return config::learner_tail_interval; });
     m.def("get_training_step", []() { return config::learner_training_step; });
     m.def("get_training_display_step", []() { return config::learner_training_display_step; });
     m.def("get_batch_size", []() { return config::learner_batch_size; });
@@ -63,6 +64,7 @@ PYBIND11_MODULE(minizero_py, m)
         .def(py::init<std::string>())
         .def("initialize", &learner::DataLoader::initialize)
         .def("load_data_from_file", &learner::DataLoader::loadDataFromFile, py::call_guard<py::gil_scoped_release>())
+        .def("finish_file", &learner::DataLoader::finishFile)
         .def(
             "update_priority", [](learner::DataLoader& data_loader, py::array_t<int>& sampled_index, py::array_t<float>& batch_values) {
                 data_loader.updatePriority(static_cast<int*>(sampled_index.request().ptr), static_cast<float*>(batch_values.request().ptr));
@@ -0,0 +1,62 @@
+#pragma once
+
+#include <cassert>
+#include <vector>
+
+namespace minizero::learner {
+
+// a complete binary tree whose leaves hold non-negative priorities and whose internal nodes hold the sums of their children
+// updating a priority and sampling an index proportional to its priority both take O(log n)
+// sampling only reads the tree, so several threads can sample concurrently as long as nobody updates it
+class SumTree {
+public:
+    SumTree(int size = 0) { reset(size); }
+
+    void reset(int size)
+    {
+        assert(size >= 0);
+        size_ = size;
+        capacity_ = 1;
+        while (capacity_ < size_) { capacity_ <<= 1; }
+        nodes_.assign(2 * capacity_, 0.0);
+    }
+
+    void set(int index, double priority)
+    {
+        assert(index >= 0 && index < size_ && priority >= 0.0);
+        int node = capacity_ + index;
+        nodes_[node] = priority;
+        // recompute the sums from the children instead of adding differences, so that rounding errors never accumulate
+        for (node >>= 1; node > 0; node >>= 1) { nodes_[node] = nodes_[2 * node] + nodes_[2 * node + 1]; }
+    }
+
+    // returns the index whose prefix sum range contains value, where value is in [0, getTotal())
+    // a value rounded past the total still ends at an index with a positive priority
+    int sample(double value) const
+    {
+        assert(getTotal() > 0.0);
+        int node = 1;
+        while (node < capacity_) {
+            const int left = 2 * node;
+            if (value < nodes_[left] || nodes_[left + 1] <= 0.0) {
+                node = left;
+            } else {
+                value -= nodes_[left];
+                node = left + 1;
+            }
+        }
+        return node - capacity_;
+    }
+
+    inline double get(int index) const { return nodes_[capacity_ + index]; }
+    inline double getTotal() const { return nodes_[1]; }
+    inline int size() const { return size_; }
+    inline int getCapacity() const { return capacity_; }
+
+private:
+    int size_;
+    int capacity_;
+    std::vector<double> nodes_;
+};
+
+} // namespace minizero::learner
@@ -1,6 +1,8 @@
 #!/usr/bin/env python
 
+import os
 import sys
+import threading
 import time
 import torch
 import torch.nn as nn
@@ -19,6 +21,10 @@ class MinizeroDadaLoader:
         self.data_loader = py.DataLoader(conf_file_name)
         self.data_loader.initialize()
         self.data_list = []
+        self.tail_file = None
+        self.tailed_files = set()
+        self.tail_lock = threading.Lock()
+        self.tail_thread = None
 
         # allocate memory
         self.sampled_index = np.zeros(py.get_batch_size() * 2, dtype=np.int32)
@@ -37,15 +43,41 @@ class MinizeroDadaLoader:
             self.value = np.zeros(py.get_batch_size() * (py.get_muzero_unrolling_step() + 1) * py.get_nn_discrete_value_size(), dtype=np.float32)
             self.reward = np.zeros(py.get_batch_size() * py.get_muzero_unrolling_step() * py.get_nn_discrete_value_size(), dtype=np.float32)
 
+    def start_tailing(self, training_dir, iteration):
+        with self.tail_lock:
+            self.tail_file = f"{training_dir}/sgf/{iteration}.sgf"
+            self.tailed_files.add(self.tail_file)
+        if self.tail_thread is None:
+            self.tail_thread = threading.Thread(target=self.tail_data, daemon=True)
+            self.tail_thread.start()
+
+    def stop_tailing(self):
+        # waits for the loading in progress, the data loader is not used by the tailing thread afterwards
+        with self.tail_lock:
+            self.tail_file = None
+
+    def tail_data(self):
+        while True:
+            time.sleep(py.get_tail_interval())
+            with self.tail_lock:
+                if self.tail_file is not None and os.path.isfile(self.tail_file):
+                    self.data_loader.load_data_from_file(self.tail_file)
+
     def load_data(self, training_dir, start_iter, end_iter):
+        self.stop_tailing()
         for i in range(start_iter, end_iter + 1):
             file_name = f"{training_dir}/sgf/{i}.sgf"
+            if file_name not in self.tailed_files and os.path.isfile(f"{training_dir}/sgf/{i}.bin"):
+                file_name = f"{training_dir}/sgf/{i}.bin"
             if file_name in self.data_list:
                 continue
             self.data_loader.load_data_from_file(file_name)
+            self.data_loader.finish_file(file_name)
             self.data_list.append(file_name)
             if len(self.data_list) > py.get_zero_replay_buffer():
-                self.data_list.pop(0)
+                evicted_file = self.data_list.pop(0)
+                self.tailed_files.discard(evicted_file)
+                self.data_loader.finish_file(evicted_file)
 
     def sample_data(self, device='cpu'):
         self.data_loader.sample_data(self.features, self.action_features, self.policy, self.value, self.reward, self.loss_scale, self.sampled_index)
@@ -252,6 +284,9 @@ if __name__ == '__main__':
                 if not py.load_config_string(conf_str):
                     eprint("Failed to load configuration string.")
                     exit(0)
+            elif command_prefix == "tail_data":
+                if py.get_tail_interval() > 0:
+                    data_loader.start_tailing(training_dir, int(command.split()[1]))
             elif command_prefix == "train":
                 _, model_file, start_iter, end_iter = command.split()
                 model_file = model_file.replace('"', '')
@@ -1,11 +1,13 @@
 #pragma once
 
 #include "network.h"
+#include "nn_evaluation_cache.h"
 #include "utils.h"
 #include <algorithm>
 #include <memory>
 #include <mutex>
 #include <string>
+#include <unordered_map>
 #include <vector>
 
 namespace minizero::network {
@@ -13,15 +15,39 @@ namespace minizero::network {
 class AlphaZeroNetworkOutput : public NetworkOutput {
 public:
     float value_;
-    std::vector<float> policy_;
-    std::vector<float> policy_logits_;
+    OutputArray policy_;
+    OutputArray policy_logits_;
+
+    // a view into the result tensors of a batch, whose arrays are set by the batch
+    AlphaZeroNetworkOutput() : value_(0.0f) {}
 
     AlphaZeroNetworkOutput(int policy_size)
+        : value_(0.0f), storage_(2 * policy_size, 0.0f)
     {
-        value_ = 0.0f;
-        policy_.resize(policy_size, 0.0f);
-        policy_logits_.resize(policy_size, 0.0f);
+        policy_ = OutputArray(storage_.data(), policy_size);
+        policy_logits_ = OutputArray(storage_.data() + policy_size, policy_size);
     }
+
+    // copies keep their own arrays, e.g., for caching an output beyond the lifetime of its batch
+    AlphaZeroNetworkOutput(const AlphaZeroNetworkOutput& output)
+        : AlphaZeroNetworkOutput(output.policy_.size())
+    {
+        value_ = output.value_;
+        std::copy(output.policy_.begin(), output.policy_.end(), policy_.begin());
+        std::copy(output.policy_logits_.begin(), output.policy_logits_.end(), policy_logits_.begin());
+    }
+    AlphaZeroNetworkOutput& operator=(const AlphaZeroNetworkOutput&) = delete;
+
+private:
+    std::vector<float> storage_;
+};
+
+// owns the result tensors of one forward pass; each output of the batch points into them
+class AlphaZeroNetworkOutputBatch {
+public:
+    torch::Tensor policy_output_;
+    torch::Tensor policy_logits_output_;
+    std::vector<AlphaZeroNetworkOutput> outputs_;
 };
 
 class AlphaZeroNetwork : public Network {
@@ -35,7 +61,9 @@ public:
     {
         assert(batch_size_ == 0); // should avoid loading model when batch size is not 0
         Network::loadModel(nn_file_name, gpu_id);
+        batch_input_.initialize({getNumInputChannels(), getInputChannelHeight(), getInputChannelWidth()}, gpu_id >= 0);
         clear();
+        if (evaluation_cache_) { evaluation_cache_->clear(); }
     }
 
     std::string toString() const override
@@ -45,50 +73,99 @@ public:
         return oss.str();
     }
 
-    int pushBack(std::vector<float> features)
+    int pushBack(const std::vector<float>& features)
     {
         assert(static_cast<int>(features.size()) == getNumInputChannels() * getInputChannelHeight() * getInputChannelWidth());
         assert(batch_size_ < kReserved_batch_size);
 
-        int index;
+        // with the evaluation cache, the same features are evaluated once per batch, and not at all if they are cached;
+        // features are the same only if both their key and their check key match
+        const uint64_t key = (evaluation_cache_ ? utils::hashFeatures(features) : 0);
+        const uint64_t check_key = (evaluation_cache_ ? utils::hashFeaturesCheckKey(features) : 0);
+        int index, row;
+        float* input;
         {
             std::lock_guard<std::mutex> lock(mutex_);
+            if (evaluation_cache_) {
+                auto it = batch_index_of_key_.find(key);
+                if (it != batch_index_of_key_.end() && batch_check_keys_[it->second] == check_key) {
+                    evaluation_cache_->addDuplicate();
+                    return it->second;
+                }
+                batch_index_of_key_[key] = batch_size_;
+            }
             index = batch_size_++;
-            tensor_input_.resize(batch_size_);
+            batch_keys_.push_back(key);
+            batch_check_keys_.push_back(check_key);
+            batch_cached_outputs_.push_back(evaluation_cache_ ? evaluation_cache_->lookup(key, check_key) : nullptr);
+            if (batch_cached_outputs_.back()) {
+                batch_rows_.push_back(-1);
+                return index;
+            }
+            row = num_rows_++;
+            batch_rows_.push_back(row);
+            input = batch_input_.allocateRow(row);
         }
-        tensor_input_[index] = torch::from_blob(features.data(), {1, getNumInputChannels(), getInputChannelHeight(), getInputChannelWidth()}).clone();
+        std::copy(features.begin(), features.end(), input);
+        return index;
+    }
+
+    // reserves a sample in the batch, whose features are written into the returned buffer by the caller before forward()
+    // the reserved samples are not looked up in the evaluation cache
+    int reserveInput(float*& features)
+    {
+        assert(batch_size_ < kReserved_batch_size);
+        std::lock_guard<std::mutex> lock(mutex_);
+        int index = batch_size_++;
+        int row = num_rows_++;
+        batch_keys_.push_back(0);
+        batch_check_keys_.push_back(0);
+        batch_cached_outputs_.push_back(nullptr);
+        batch_rows_.push_back(row);
+        features = batch_input_.allocateRow(row);
         return index;
     }
 
     std::vector<std::shared_ptr<NetworkOutput>> forward()
     {
         assert(batch_size_ > 0);
-        auto forward_result = network_.forward(std::vector<torch::jit::IValue>{torch::cat(tensor_input_).to(getDevice())}).toGenericDict();
-
-        auto policy_output = forward_result.at("policy").toTensor().to(at::kCPU);
-        auto policy_logits_output = forward_result.at("policy_logit").toTensor().to(at::kCPU);
-        auto value_output = forward_result.at("value").toTensor().to(at::kCPU);
-        assert(policy_output.numel() == batch_size_ * getActionSize());
-        assert(policy_logits_output.numel() == batch_size_ * getActionSize());
-        assert(value_output.numel() == batch_size_ * getDiscreteValueSize());
+        torch::Tensor policy_output, policy_logits_output, value_output;
+        const int num_rows = num_rows_;
+        if (num_rows > 0) { // all inputs may be found in the evaluation cache
+            auto forward_result = network_.forward(std::vector<torch::jit::IValue>{batch_input_.getBatch(num_rows, getDevice())}).toGenericDict();
+            policy_output = forward_result.at("policy").toTensor().to(at::kCPU).contiguous();
+            policy_logits_output = forward_result.at("policy_logit").toTensor().to(at::kCPU).contiguous();
+            value_output = forward_result.at("value").toTensor().to(at::kCPU).contiguous();
+            assert(policy_output.numel() == num_rows * getActionSize());
+            assert(policy_logits_output.numel() == num_rows * getActionSize());
+            assert(value_output.numel() == num_rows * getDiscreteValueSize());
+        }
 
+        // the outputs share the ownership of the batch, so no sample allocates or copies its own arrays
         const int policy_size = getActionSize();
+        auto batch = std::make_shared<AlphaZeroNetworkOutputBatch>();
+        batch->policy_output_ = policy_output;
+        batch->policy_logits_output_ = policy_logits_output;
+        batch->outputs_.resize(num_rows);
         std::vector<std::shared_ptr<NetworkOutput>> network_outputs;
-        for (int i = 0; i < batch_size_; ++i) {
-            network_outputs.emplace_back(std::make_shared<AlphaZeroNetworkOutput>(policy_size));
-            auto alphazero_network_output = std::static_pointer_cast<AlphaZeroNetworkOutput>(network_outputs.back());
+        network_outputs.reserve(batch_size_);
+        for (int index = 0; index < batch_size_; ++index) {
+            if (batch_cached_outputs_[index]) {
+                network_outputs.push_back(batch_cached_outputs_[index]);
+                continue;
+            }
+
+            const int i = batch_rows_[index];
+            AlphaZeroNetworkOutput* alphazero_network_output = &batch->outputs_[i];
+            network_outputs.emplace_back(batch, alphazero_network_output);
 
             // policy & policy logits
-            std::copy(policy_output.data_ptr<float>() + i * policy_size,
-                      policy_output.data_ptr<float>() + (i + 1) * policy_size,
-                      alphazero_network_output->policy_.begin());
-            std::copy(policy_logits_output.data_ptr<float>() + i * policy_size,
-                      policy_logits_output.data_ptr<float>() + (i + 1) * policy_size,
-                      alphazero_network_output->policy_logits_.begin());
+            alphazero_network_output->policy_ = OutputArray(policy_output.data_ptr<float>() + i * policy_size, policy_size);
+            alphazero_network_output->policy_logits_ = OutputArray(policy_logits_output.data_ptr<float>() + i * policy_size, policy_size);
 
             // value
             if (getDiscreteValueSize() == 1) {
-                alphazero_network_output->value_ = value_output[i].item<float>();
+                alphazero_network_output->value_ = value_output.data_ptr<float>()[i];
             } else {
                 int start_value = -getDiscreteValueSize() / 2;
                 alphazero_network_output->value_ = std::accumulate(value_output.data_ptr<float>() + i * getDiscreteValueSize(),
@@ -97,6 +174,7 @@ public:
                                                                    [&start_value](const float& sum, const float& value) { return sum + value * start_value++; });
                 alphazero_network_output->value_ = utils::invertValue(alphazero_network_output->value_);
             }
+            if (evaluation_cache_) { evaluation_cache_->insert(batch_keys_[index], batch_check_keys_[index], std::make_shared<AlphaZeroNetworkOutput>(*alphazero_network_output)); }
         }
 
         clear();
@@ -104,18 +182,31 @@ public:
     }
 
     inline int getBatchSize() const { return batch_size_; }
+    inline void setEvaluationCache(const std::shared_ptr<NNEvaluationCache>& evaluation_cache) { evaluation_cache_ = evaluation_cache; }
+    inline std::shared_ptr<NNEvaluationCache> getEvaluationCache() const { return evaluation_cache_; }
 
 private:
     inline void clear()
     {
         batch_size_ = 0;
-        tensor_input_.clear();
-        tensor_input_.reserve(kReserved_batch_size);
+        num_rows_ = 0;
+        batch_rows_.clear();
+        batch_keys_.clear();
+        batch_check_keys_.clear();
+        batch_cached_outputs_.clear();
+        batch_index_of_key_.clear();
     }
 
     int batch_size_;
+    int num_rows_;
     std::mutex mutex_;
-    std::vector<torch::Tensor> tensor_input_;
+    BatchInput batch_input_;
+    std::vector<int> batch_rows_;
+    std::vector<uint64_t> batch_keys_;
+    std::vector<uint64_t> batch_check_keys_;
+    std::vector<std::shared_ptr<NetworkOutput>> batch_cached_outputs_;
+    std::unordered_map<uint64_t, int> batch_index_of_key_;
+    std::shared_ptr<NNEvaluationCache> evaluation_cache_;
 
     const int kReserved_batch_size = 4096;
 };
@@ -15,18 +15,44 @@ class MuZeroNetworkOutput : public NetworkOutput {
 public:
     float value_;
     float reward_;
-    std::vector<float> policy_;
-    std::vector<float> policy_logits_;
-    std::vector<float> hidden_state_;
+    OutputArray policy_;
+    OutputArray policy_logits_;
+    OutputArray hidden_state_;
+
+    // a view into the result tensors of a batch, whose arrays are set by the batch
+    MuZeroNetworkOutput() : value_(0.0f), reward_(0.0f) {}
 
     MuZeroNetworkOutput(int policy_size, int hidden_state_size)
+        : value_(0.0f), reward_(0.0f), storage_(2 * policy_size + hidden_state_size, 0.0f)
     {
-        value_ = 0.0f;
-        reward_ = 0.0f;
-        policy_.resize(policy_size, 0.0f);
-        policy_logits_.resize(policy_size, 0.0f);
-        hidden_state_.resize(hidden_state_size, 0.0f);
+        policy_ = OutputArray(storage_.data(), policy_size);
+        policy_logits_ = OutputArray(storage_.data() + policy_size, policy_size);
+        hidden_state_ = OutputArray(storage_.data() + 2 * policy_size, hidden_state_size);
     }
+
+    // copies keep their own arrays, e.g., for keeping an output beyond the lifetime of its batch
+    MuZeroNetworkOutput(const MuZeroNetworkOutput& output)
+        : MuZeroNetworkOutput(output.policy_.size(), output.hidden_state_.size())
+    {
+        value_ = output.value_;
+        reward_ = output.reward_;
+        std::copy(output.policy_.begin(), output.policy_.end(), policy_.begin());
+        std::copy(output.policy_logits_.begin(), output.policy_logits_.end(), policy_logits_.begin());
+        std::copy(output.hidden_state_.begin(), output.hidden_state_.end(), hidden_state_.begin());
+    }
+    MuZeroNetworkOutput& operator=(const MuZeroNetworkOutput&) = delete;
+
+private:
+    std::vector<float> storage_;
+};
+
+// owns the result tensors of one inference; each output of the batch points into them
+class MuZeroNetworkOutputBatch {
+public:
+    torch::Tensor policy_output_;
+    torch::Tensor policy_logits_output_;
+    torch::Tensor hidden_state_output_;
+    std::vector<MuZeroNetworkOutput> outputs_;
 };
 
 class MuZeroNetwork : public Network {
@@ -35,12 +61,6 @@ public:
     {
         num_action_feature_channels_ = -1;
         initial_input_batch_size_ = recurrent_input_batch_size_ = 0;
-        initial_tensor_input_.clear();
-        initial_tensor_input_.reserve(kReserved_batch_size);
-        recurrent_tensor_feature_input_.clear();
-        recurrent_tensor_feature_input_.reserve(kReserved_batch_size);
-        recurrent_tensor_action_input_.clear();
-        recurrent_tensor_action_input_.reserve(kReserved_batch_size);
     }
 
     void loadModel(const std::string& nn_file_name, const int gpu_id) override
@@ -51,6 +71,9 @@ public:
         num_action_feature_channels_ = network_.get_method("get_num_action_feature_channels")(dummy).toInt();
         initial_input_batch_size_ = 0;
         recurrent_input_batch_size_ = 0;
+        initial_input_.initialize({getNumInputChannels(), getInputChannelHeight(), getInputChannelWidth()}, gpu_id >= 0);
+        recurrent_feature_input_.initialize({getNumHiddenChannels(), getHiddenChannelHeight(), getHiddenChannelWidth()}, gpu_id >= 0);
+        recurrent_action_input_.initialize({getNumActionFeatureChannels(), getHiddenChannelHeight(), getHiddenChannelWidth()}, gpu_id >= 0);
     }
 
     std::string toString() const override
@@ -61,43 +84,52 @@ public:
         return oss.str();
     }
 
-    int pushBackInitialData(std::vector<float> features)
+    int pushBackInitialData(const std::vector<float>& features)
     {
         assert(static_cast<int>(features.size()) == getNumInputChannels() * getInputChannelHeight() * getInputChannelWidth());
 
-        int index;
-        {
-            std::lock_guard<std::mutex> lock(initial_mutex_);
-            index = initial_input_batch_size_++;
-            initial_tensor_input_.resize(initial_input_batch_size_);
-        }
-        initial_tensor_input_[index] = torch::from_blob(features.data(), {1, getNumInputChannels(), getInputChannelHeight(), getInputChannelWidth()}).clone();
+        float* feature_input;
+        int index = reserveInitialInput(feature_input);
+        std::copy(features.begin(), features.end(), feature_input);
         return index;
     }
 
-    int pushBackRecurrentData(std::vector<float> features, std::vector<float> actions)
+    int pushBackRecurrentData(const std::vector<float>& features, const std::vector<float>& actions)
     {
         assert(static_cast<int>(features.size()) == getNumHiddenChannels() * getHiddenChannelHeight() * getHiddenChannelWidth());
         assert(static_cast<int>(actions.size()) == getNumActionFeatureChannels() * getHiddenChannelHeight() * getHiddenChannelWidth());
 
-        int index;
-        {
-            std::lock_guard<std::mutex> lock(recurrent_mutex_);
-            index = recurrent_input_batch_size_++;
-            recurrent_tensor_feature_input_.resize(recurrent_input_batch_size_);
-            recurrent_tensor_action_input_.resize(recurrent_input_batch_size_);
-        }
-        recurrent_tensor_feature_input_[index] = torch::from_blob(features.data(), {1, getNumHiddenChannels(), getHiddenChannelHeight(), getHiddenChannelWidth()}).clone();
-        recurrent_tensor_action_input_[index] = torch::from_blob(actions.data(), {1, getNumActionFeatureChannels(), getHiddenChannelHeight(), getHiddenChannelWidth()}).clone();
+        float *feature_input, *action_input;
+        int index = reserveRecurrentInput(feature_input, action_input);
+        std::copy(features.begin(), features.end(), feature_input);
+        std::copy(actions.begin(), actions.end(), action_input);
+        return index;
+    }
+
+    // reserve a sample in the batch, whose inputs are written into the returned buffers by the caller before the inference
+    int reserveInitialInput(float*& features)
+    {
+        assert(initial_input_batch_size_ < kReserved_batch_size);
+        std::lock_guard<std::mutex> lock(initial_mutex_);
+        int index = initial_input_batch_size_++;
+        features = initial_input_.allocateRow(index);
+        return index;
+    }
+
+    int reserveRecurrentInput(float*& features, float*& actions)
+    {
+        assert(recurrent_input_batch_size_ < kReserved_batch_size);
+        std::lock_guard<std::mutex> lock(recurrent_mutex_);
+        int index = recurrent_input_batch_size_++;
+        features = recurrent_feature_input_.allocateRow(index);
+        actions = recurrent_action_input_.allocateRow(index);
         return index;
     }
 
     inline std::vector<std::shared_ptr<NetworkOutput>> initialInference()
     {
         assert(initial_input_batch_size_ > 0);
-        auto outputs = forward("initial_inference", {torch::cat(initial_tensor_input_).to(getDevice())}, initial_input_batch_size_);
-        initial_tensor_input_.clear();
-        initial_tensor_input_.reserve(kReserved_batch_size);
+        auto outputs = forward("initial_inference", {initial_input_.getBatch(initial_input_batch_size_, getDevice())}, initial_input_batch_size_);
         initial_input_batch_size_ = 0;
         return outputs;
     }
@@ -106,12 +138,8 @@ public:
     {
         assert(recurrent_input_batch_size_ > 0);
         auto outputs = forward("recurrent_inference",
-                               {{torch::cat(recurrent_tensor_feature_input_).to(getDevice())}, {torch::cat(recurrent_tensor_action_input_).to(getDevice())}},
+                               {recurrent_feature_input_.getBatch(recurrent_input_batch_size_, getDevice()), recurrent_action_input_.getBatch(recurrent_input_batch_size_, getDevice())},
                                recurrent_input_batch_size_);
-        recurrent_tensor_feature_input_.clear();
-        recurrent_tensor_feature_input_.reserve(kReserved_batch_size);
-        recurrent_tensor_action_input_.clear();
-        recurrent_tensor_action_input_.reserve(kReserved_batch_size);
         recurrent_input_batch_size_ = 0;
         return outputs;
     }
@@ -126,11 +154,11 @@ private:
         assert(network_.find_method(method));
 
         auto forward_result = network_.get_method(method)(inputs).toGenericDict();
-        auto policy_output = forward_result.at("policy").toTensor().to(at::kCPU);
-        auto policy_logits_output = forward_result.at("policy_logit").toTensor().to(at::kCPU);
-        auto value_output = forward_result.at("value").toTensor().to(at::kCPU);
-        auto reward_output = (forward_result.contains("reward") ? forward_result.at("reward").toTensor().to(at::kCPU) : torch::zeros(0));
-        auto hidden_state_output = forward_result.at("hidden_state").toTensor().to(at::kCPU);
+        auto policy_output = forward_result.at("policy").toTensor().to(at::kCPU).contiguous();
+        auto policy_logits_output = forward_result.at("policy_logit").toTensor().to(at::kCPU).contiguous();
+        auto value_output = forward_result.at("value").toTensor().to(at::kCPU).contiguous();
+        auto reward_output = (forward_result.contains("reward") ? forward_result.at("reward").toTensor().to(at::kCPU).contiguous() : torch::zeros(0));
+        auto hidden_state_output = forward_result.at("hidden_state").toTensor().to(at::kCPU).contiguous();
         assert(policy_output.numel() == batch_size * getActionSize());
         assert(policy_logits_output.numel() == batch_size * getActionSize());
         assert((getNetworkTypeName() != "muzero_atari" && value_output.numel() == batch_size) || (getNetworkTypeName() == "muzero_atari" && value_output.numel() == batch_size * getDiscreteValueSize()));
@@ -139,20 +167,21 @@ private:
 
         const int policy_size = getActionSize();
         const int hidden_state_size = getNumHiddenChannels() * getHiddenChannelHeight() * getHiddenChannelWidth();
+        // the outputs share the ownership of the batch, so no sample allocates or copies its own arrays
+        auto batch = std::make_shared<MuZeroNetworkOutputBatch>();
+        batch->policy_output_ = policy_output;
+        batch->policy_logits_output_ = policy_logits_output;
+        batch->hidden_state_output_ = hidden_state_output;
+        batch->outputs_.resize(batch_size);
         std::vector<std::shared_ptr<NetworkOutput>> network_outputs;
+        network_outputs.reserve(batch_size);
         for (int i = 0; i < batch_size; ++i) {
-            network_outputs.emplace_back(std::make_shared<MuZeroNetworkOutput>(policy_size, hidden_state_size));
-            auto muzero_network_output = std::static_pointer_cast<MuZeroNetworkOutput>(network_outputs.back());
-
-            std::copy(policy_output.data_ptr<float>() + i * policy_size,
-                      policy_output.data_ptr<float>() + (i + 1) * policy_size,
-                      muzero_network_output->policy_.begin());
-            std::copy(policy_logits_output.data_ptr<float>() + i * policy_size,
-                      policy_logits_output.data_ptr<float>() + (i + 1) * policy_size,
-                      muzero_network_output->policy_logits_.begin());
-            std::copy(hidden_state_output.data_ptr<float>() + i * hidden_state_size,
-                      hidden_state_output.data_ptr<float>() + (i + 1) * hidden_state_size,
-                      muzero_network_output->hidden_state_.begin());
+            MuZeroNetworkOutput* muzero_network_output = &batch->outputs_[i];
+            network_outputs.emplace_back(batch, muzero_network_output);
+
+            muzero_network_output->policy_ = OutputArray(policy_output.data_ptr<float>() + i * policy_size, policy_size);
+            muzero_network_output->policy_logits_ = OutputArray(policy_logits_output.data_ptr<float>() + i * policy_size, policy_size);
+            muzero_network_output->hidden_state_ = OutputArray(hidden_state_output.data_ptr<float>() + i * hidden_state_size, hidden_state_size);
 
             if (getNetworkTypeName() == "muzero_atari") {
                 int start_value = -getDiscreteValueSize() / 2;
@@ -170,7 +199,7 @@ private:
                     muzero_network_output->reward_ = utils::invertValue(muzero_network_output->reward_);
                 }
             } else {
-                muzero_network_output->value_ = value_output[i].item<float>();
+                muzero_network_output->value_ = value_output.data_ptr<float>()[i];
             }
         }
 
@@ -182,9 +211,9 @@ private:
     int recurrent_input_batch_size_;
     std::mutex initial_mutex_;
     std::mutex recurrent_mutex_;
-    std::vector<torch::Tensor> initial_tensor_input_;
-    std::vector<torch::Tensor> recurrent_tensor_feature_input_;
-    std::vector<torch::Tensor> recurrent_tensor_action_input_;
+    BatchInput initial_input_;
+    BatchInput recurrent_feature_input_;
+    BatchInput recurrent_action_input_;
 
     const int kReserved_batch_size = 4096;
 };
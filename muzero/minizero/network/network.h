@@ -1,6 +1,9 @@
 #pragma once
 
+#include <cassert>
+#include <functional>
 #include <memory>
+#include <numeric>
 #include <string>
 #include <torch/script.h>
 #include <vector>
@@ -12,6 +15,110 @@ public:
     virtual ~NetworkOutput() = default;
 };
 
+// the floats of one sample in a network output, stored either by the output itself or by the result tensors of its whole batch
+class OutputArray {
+public:
+    OutputArray() : data_(nullptr), size_(0) {}
+    OutputArray(float* data, size_t size) : data_(data), size_(size) {}
+
+    inline float& operator[](size_t index)
+    {
+        assert(index < size_);
+        return data_[index];
+    }
+    inline const float& operator[](size_t index) const
+    {
+        assert(index < size_);
+        return data_[index];
+    }
+    inline size_t size() const { return size_; }
+    inline float* begin() { return data_; }
+    inline float* end() { return data_ + size_; }
+    inline const float* begin() const { return data_; }
+    inline const float* end() const { return data_ + size_; }
+    inline std::vector<float> toVector() const { return std::vector<float>(begin(), end()); }
+
+private:
+    float* data_;
+    size_t size_;
+};
+
+// a preallocated batch of network inputs; each sample is written straight into its own row,
+// and the filled rows are handed to the network without per-sample tensors or concatenation
+class BatchInput {
+public:
+    BatchInput() : sample_size_(0), capacity_(0), pin_memory_(false) {}
+
+    void initialize(const std::vector<int64_t>& sample_shape, bool pin_memory)
+    {
+        sample_shape_ = sample_shape;
+        sample_size_ = std::accumulate(sample_shape.begin(), sample_shape.end(), static_cast<int64_t>(1), std::multiplies<int64_t>());
+        pin_memory_ = pin_memory;
+        chunks_.clear();
+        capacity_ = 0;
+        addChunk(kInitialCapacity);
+    }
+
+    // rows are allocated in order under the lock of the network; the returned buffer stays valid until the batch is consumed
+    float* allocateRow(int row)
+    {
+        assert(sample_size_ > 0 && row >= 0);
+        while (row >= capacity_) { addChunk(capacity_); }
+        for (const auto& chunk : chunks_) {
+            if (row < chunk.num_rows_) { return chunk.data_ + row * sample_size_; }
+            row -= chunk.num_rows_;
+        }
+        assert(false);
+        return nullptr;
+    }
+
+    // rows spread over several chunks are concatenated once, then merged into a single chunk for the following batches
+    torch::Tensor getBatch(int batch_size, const torch::Device& device)
+    {
+        assert(batch_size > 0 && batch_size <= capacity_);
+        if (chunks_.size() == 1 || batch_size <= chunks_[0].num_rows_) { return chunks_[0].tensor_.narrow(0, 0, batch_size).to(device, /*non_blocking=*/true); }
+
+        std::vector<torch::Tensor> tensors;
+        for (int row = 0, chunk_id = 0; row < batch_size; row += chunks_[chunk_id++].num_rows_) {
+            tensors.push_back(chunks_[chunk_id].tensor_.narrow(0, 0, std::min(chunks_[chunk_id].num_rows_, batch_size - row)));
+        }
+        torch::Tensor batch = torch::cat(tensors).to(device, /*non_blocking=*/true);
+        int capacity = capacity_;
+        chunks_.clear();
+        capacity_ = 0;
+        addChunk(capacity);
+        return batch;
+    }
+
+    inline int64_t getSampleSize() const { return sample_size_; }
+    inline int getCapacity() const { return capacity_; }
+
+private:
+    class Chunk {
+    public:
+        int num_rows_;
+        float* data_;
+        torch::Tensor tensor_;
+    };
+
+    void addChunk(int num_rows)
+    {
+        std::vector<int64_t> shape{num_rows};
+        shape.insert(shape.end(), sample_shape_.begin(), sample_shape_.end());
+        torch::Tensor tensor = torch::empty(shape, torch::TensorOptions().dtype(torch::kFloat).pinned_memory(pin_memory_));
+        chunks_.push_back({num_rows, tensor.data_ptr<float>(), tensor});
+        capacity_ += num_rows;
+    }
+
+    int64_t sample_size_;
+    int capacity_;
+    bool pin_memory_;
+    std::vector<int64_t> sample_shape_;
+    std::vector<Chunk> chunks_;
+
+    const int kInitialCapacity = 64;
+};
+
 class Network {
 public:
     Network();
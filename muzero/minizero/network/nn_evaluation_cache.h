@@ -0,0 +1,120 @@
+#pragma once
+
+#include "network.h"
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace minizero::network {
+
+// a least-recently-used cache of network outputs keyed by the hash of the input features, with a second independent hash
+// of the features checked on every hit, so that a key collision is a miss instead of the output of another position;
+// the cache is split into shards with their own locks, so that networks and actors on different threads rarely contend
+class NNEvaluationCache {
+public:
+    NNEvaluationCache(int capacity, int num_shards = 64)
+        : shards_(num_shards)
+    {
+        assert(capacity > 0 && num_shards > 0);
+        for (auto& shard : shards_) { shard.capacity_ = std::max(1, (capacity + num_shards - 1) / num_shards); }
+        clear();
+    }
+
+    std::shared_ptr<NetworkOutput> lookup(uint64_t key, uint64_t check_key)
+    {
+        num_lookups_.fetch_add(1, std::memory_order_relaxed);
+        Shard& shard = getShard(key);
+        std::lock_guard<std::mutex> lock(shard.mutex_);
+        auto it = shard.index_.find(key);
+        if (it == shard.index_.end()) { return nullptr; }
+        if (it->second->check_key_ != check_key) {
+            num_collisions_.fetch_add(1, std::memory_order_relaxed);
+            return nullptr;
+        }
+        shard.entries_.splice(shard.entries_.begin(), shard.entries_, it->second);
+        num_hits_.fetch_add(1, std::memory_order_relaxed);
+        return it->second->network_output_;
+    }
+
+    // an entry with the same key is replaced, even if it belongs to other features
+    void insert(uint64_t key, uint64_t check_key, const std::shared_ptr<NetworkOutput>& network_output)
+    {
+        Shard& shard = getShard(key);
+        std::lock_guard<std::mutex> lock(shard.mutex_);
+        auto it = shard.index_.find(key);
+        if (it != shard.index_.end()) {
+            it->second->check_key_ = check_key;
+            it->second->network_output_ = network_output;
+            shard.entries_.splice(shard.entries_.begin(), shard.entries_, it->second);
+            return;
+        }
+        if (static_cast<int>(shard.entries_.size()) >= shard.capacity_) {
+            shard.index_.erase(shard.entries_.back().key_);
+            shard.entries_.pop_back();
+        }
+        shard.entries_.push_front({key, check_key, network_output});
+        shard.index_[key] = shard.entries_.begin();
+    }
+
+    // must not run concurrently with lookups or inserts, e.g., when loading a new model
+    void clear()
+    {
+        for (auto& shard : shards_) {
+            shard.entries_.clear();
+            shard.index_.clear();
+        }
+        num_lookups_ = num_hits_ = num_collisions_ = num_duplicates_ = 0;
+    }
+
+    inline void addDuplicate() { num_duplicates_.fetch_add(1, std::memory_order_relaxed); }
+    inline uint64_t getNumLookups() const { return num_lookups_.load(std::memory_order_relaxed); }
+    inline uint64_t getNumHits() const { return num_hits_.load(std::memory_order_relaxed); }
+    inline uint64_t getNumCollisions() const { return num_collisions_.load(std::memory_order_relaxed); }
+    inline uint64_t getNumDuplicates() const { return num_duplicates_.load(std::memory_order_relaxed); }
+    inline float getHitRate() const { return (getNumLookups() > 0 ? static_cast<float>(getNumHits()) / getNumLookups() : 0.0f); }
+
+    std::string toString() const
+    {
+        std::ostringstream oss;
+        oss << "nn evaluation cache: lookups: " << getNumLookups()
+            << ", hits: " << getNumHits() << " (" << getHitRate() * 100 << "%)"
+            << ", key collisions: " << getNumCollisions()
+            << ", duplicates in batch: " << getNumDuplicates();
+        return oss.str();
+    }
+
+private:
+    class Entry {
+    public:
+        uint64_t key_;
+        uint64_t check_key_;
+        std::shared_ptr<NetworkOutput> network_output_;
+    };
+
+    class Shard {
+    public:
+        int capacity_;
+        std::mutex mutex_;
+        std::list<Entry> entries_;
+        std::unordered_map<uint64_t, std::list<Entry>::iterator> index_;
+    };
+
+    inline Shard& getShard(uint64_t key) { return shards_[(key >> 32) % shards_.size()]; }
+
+    std::vector<Shard> shards_;
+    std::atomic<uint64_t> num_lookups_;
+    std::atomic<uint64_t> num_hits_;
+    std::atomic<uint64_t> num_collisions_;
+    std::atomic<uint64_t> num_duplicates_;
+};
+
+} // namespace minizero::network
@@ -0,0 +1,82 @@
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <type_traits>
+#include <vector>
+
+namespace minizero::utils {
+
+// a monotonic arena: allocations are carved from large blocks and are only released together when the arena is destroyed
+class Arena {
+public:
+    Arena(size_t block_size = 1 << 20)
+        : block_size_(block_size), block_used_(block_size), num_bytes_(0) {}
+
+    void* allocate(size_t size, size_t alignment)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        num_bytes_ += size;
+        if (size > block_size_ / 4) { // large allocations get their own blocks, so that the current block is not wasted
+            large_blocks_.emplace_back(std::make_unique<char[]>(size));
+            return large_blocks_.back().get();
+        }
+
+        size_t offset = (block_used_ + alignment - 1) / alignment * alignment;
+        if (offset + size > block_size_) {
+            blocks_.emplace_back(std::make_unique<char[]>(block_size_));
+            offset = 0;
+        }
+        block_used_ = offset + size;
+        return blocks_.back().get() + offset;
+    }
+
+    inline size_t getNumBytes() const { return num_bytes_; }
+
+private:
+    size_t block_size_;
+    size_t block_used_;
+    size_t num_bytes_;
+    std::mutex mutex_;
+    std::vector<std::unique_ptr<char[]>> blocks_;
+    std::vector<std::unique_ptr<char[]>> large_blocks_;
+};
+
+// allocates from an arena shared by every container using it, or from the heap without an arena
+// each allocator owns a reference to its arena, so the arena lives until the last container allocated from it is destroyed
+template <class T>
+class ArenaAllocator {
+public:
+    typedef T value_type;
+    typedef std::true_type propagate_on_container_copy_assignment;
+    typedef std::true_type propagate_on_container_move_assignment;
+    typedef std::true_type propagate_on_container_swap;
+
+    ArenaAllocator(std::shared_ptr<Arena> arena = nullptr) noexcept : arena_(std::move(arena)) {}
+    template <class U>
+    ArenaAllocator(const ArenaAllocator<U>& allocator) noexcept : arena_(allocator.getArena()) {}
+
+    T* allocate(size_t n)
+    {
+        if (!arena_) { return std::allocator<T>().allocate(n); }
+        return static_cast<T*>(arena_->allocate(n * sizeof(T), alignof(T)));
+    }
+
+    void deallocate(T* p, size_t n)
+    {
+        if (!arena_) { std::allocator<T>().deallocate(p, n); }
+    }
+
+    inline const std::shared_ptr<Arena>& getArena() const { return arena_; }
+
+    template <class U>
+    inline bool operator==(const ArenaAllocator<U>& allocator) const { return arena_ == allocator.getArena(); }
+    template <class U>
+    inline bool operator!=(const ArenaAllocator<U>& allocator) const { return arena_ != allocator.getArena(); }
+
+private:
+    std::shared_ptr<Arena> arena_;
+};
+
+} // namespace minizero::utils
@@ -1,6 +1,8 @@
 #pragma once
 
+#include <atomic>
 #include <boost/thread.hpp>
+#include <cstdint>
 #include <memory>
 #include <vector>
 
@@ -12,22 +14,72 @@ public:
     virtual ~BaseSharedData() = default;
 };
 
+// wakes all slave threads for a job with one broadcast and lets the last finishing thread wake the master
+// both sides spin briefly before sleeping, since jobs are often issued back to back
+class JobDispatcher {
+public:
+    JobDispatcher()
+        : generation_(0), num_running_(0) {}
+
+    // called by the master: starts a job on all slave threads and waits until every one of them has finished it
+    void dispatch(int num_threads)
+    {
+        num_running_.store(num_threads, std::memory_order_relaxed);
+        {
+            boost::lock_guard<boost::mutex> lock(mutex_);
+            generation_.fetch_add(1, std::memory_order_release);
+        }
+        start_cv_.notify_all();
+
+        for (int spin = 0; spin < kNumSpins && num_running_.load(std::memory_order_acquire) > 0; ++spin) { boost::this_thread::yield(); }
+        boost::unique_lock<boost::mutex> lock(mutex_);
+        while (num_running_.load(std::memory_order_acquire) > 0) { finish_cv_.wait(lock); }
+    }
+
+    // called by slave threads: waits for a job newer than the given generation and returns its generation
+    uint64_t waitForJob(uint64_t generation)
+    {
+        for (int spin = 0; spin < kNumSpins && generation_.load(std::memory_order_acquire) == generation; ++spin) {
+            boost::this_thread::interruption_point();
+            boost::this_thread::yield();
+        }
+        boost::unique_lock<boost::mutex> lock(mutex_);
+        while (generation_.load(std::memory_order_acquire) == generation) { start_cv_.wait(lock); }
+        return generation_.load(std::memory_order_acquire);
+    }
+
+    void finishJob()
+    {
+        if (num_running_.fetch_sub(1, std::memory_order_acq_rel) > 1) { return; }
+        boost::lock_guard<boost::mutex> lock(mutex_);
+        finish_cv_.notify_one();
+    }
+
+private:
+    static constexpr int kNumSpins = 1000;
+
+    std::atomic<uint64_t> generation_;
+    std::atomic<int> num_running_;
+    boost::mutex mutex_;
+    boost::condition_variable start_cv_;
+    boost::condition_variable finish_cv_;
+};
+
 class BaseSlaveThread {
 public:
     BaseSlaveThread(int id, std::shared_ptr<BaseSharedData> shared_data)
         : id_(id),
-          shared_data_(shared_data),
-          start_barrier_(2),
-          finish_barrier_(2) {}
+          shared_data_(shared_data) {}
     virtual ~BaseSlaveThread() = default;
 
     void run()
     {
         initialize();
+        uint64_t generation = 0;
         while (!isDone()) {
-            start_barrier_.wait();
+            generation = dispatcher_->waitForJob(generation);
             runJob();
-            finish_barrier_.wait();
+            dispatcher_->finishJob();
         }
     }
 
@@ -35,14 +87,12 @@ public:
     virtual void runJob() = 0;
     virtual bool isDone() = 0;
 
-    inline void start() { start_barrier_.wait(); }
-    inline void finish() { finish_barrier_.wait(); }
+    inline void setDispatcher(std::shared_ptr<JobDispatcher> dispatcher) { dispatcher_ = dispatcher; }
 
 protected:
     int id_;
     std::shared_ptr<BaseSharedData> shared_data_;
-    boost::barrier start_barrier_;
-    boost::barrier finish_barrier_;
+    std::shared_ptr<JobDispatcher> dispatcher_;
 };
 
 class BaseParalleler {
@@ -58,8 +108,7 @@ public:
     void run()
     {
         initialize();
-        for (auto& t : slave_threads_) { t->start(); }
-        for (auto& t : slave_threads_) { t->finish(); }
+        runSlaveThreads();
         summarize();
     }
 
@@ -70,17 +119,22 @@ protected:
     void createSlaveThreads(int num_threads)
     {
         createSharedData();
+        dispatcher_ = std::make_shared<JobDispatcher>();
         for (int id = 0; id < num_threads; ++id) {
             slave_threads_.emplace_back(newSlaveThread(id));
+            slave_threads_.back()->setDispatcher(dispatcher_);
             thread_groups_.create_thread(boost::bind(&BaseSlaveThread::run, slave_threads_.back()));
         }
     }
 
+    inline void runSlaveThreads() { dispatcher_->dispatch(slave_threads_.size()); }
+
     virtual void createSharedData() = 0;
     virtual std::shared_ptr<BaseSlaveThread> newSlaveThread(int id) = 0;
 
     boost::thread_group thread_groups_;
     std::shared_ptr<BaseSharedData> shared_data_;
+    std::shared_ptr<JobDispatcher> dispatcher_;
     std::vector<std::shared_ptr<BaseSlaveThread>> slave_threads_;
 };
 
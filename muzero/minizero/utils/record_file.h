@@ -0,0 +1,209 @@
+#pragma once
+
+#include <boost/iostreams/device/mapped_file.hpp>
+#include <cassert>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <ios>
+#include <ostream>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace minizero::utils {
+
+// appends little-endian fixed-width values and length-prefixed strings to a byte buffer
+class BinaryWriter {
+public:
+    template <class T>
+    inline void write(const T& value) { buffer_.append(reinterpret_cast<const char*>(&value), sizeof(T)); }
+
+    template <class T>
+    inline void writeArray(const T* values, size_t size) { buffer_.append(reinterpret_cast<const char*>(values), size * sizeof(T)); }
+
+    inline void writeString(const std::string& str)
+    {
+        write<uint32_t>(str.size());
+        buffer_.append(str);
+    }
+
+    inline std::string& getBuffer() { return buffer_; }
+
+private:
+    std::string buffer_;
+};
+
+// reads what BinaryWriter wrote; every read fails once the data runs out, so callers only check isValid() at the end
+class BinaryReader {
+public:
+    BinaryReader(const char* data, size_t size)
+        : data_(data), end_(data + size), valid_(true) {}
+
+    template <class T>
+    inline T read()
+    {
+        T value{};
+        readArray(&value, 1);
+        return value;
+    }
+
+    template <class T>
+    inline void readArray(T* values, size_t size)
+    {
+        if (!reserve(size * sizeof(T))) { return; }
+        std::memcpy(values, data_, size * sizeof(T));
+        data_ += size * sizeof(T);
+    }
+
+    inline std::string readString()
+    {
+        const uint32_t size = read<uint32_t>();
+        if (!reserve(size)) { return ""; }
+        std::string str(data_, size);
+        data_ += size;
+        return str;
+    }
+
+    inline bool isValid() const { return valid_; }
+
+private:
+    inline bool reserve(size_t size)
+    {
+        valid_ = valid_ && static_cast<size_t>(end_ - data_) >= size;
+        return valid_;
+    }
+
+    const char* data_;
+    const char* end_;
+    bool valid_;
+};
+
+// a record file stores opaque records back to back, followed by an index of their offsets:
+//   magic, records..., offsets[num_records], num_records, index offset, magic
+// so that a reader can map the file and jump to any record without parsing the ones before it
+class RecordFileWriter {
+public:
+    RecordFileWriter(std::ostream& out)
+        : out_(out), offset_(0)
+    {
+        writeRaw(kMagic);
+    }
+
+    void write(const std::string& record)
+    {
+        offsets_.push_back(offset_);
+        out_.write(record.data(), record.size());
+        offset_ += record.size();
+    }
+
+    void close()
+    {
+        const uint64_t index_offset = offset_;
+        for (uint64_t offset : offsets_) { writeRaw(offset); }
+        writeRaw(static_cast<uint64_t>(offsets_.size()));
+        writeRaw(index_offset);
+        writeRaw(kMagic);
+        out_.flush();
+    }
+
+    inline size_t getNumRecords() const { return offsets_.size(); }
+
+private:
+    template <class T>
+    void writeRaw(const T& value)
+    {
+        out_.write(reinterpret_cast<const char*>(&value), sizeof(T));
+        offset_ += sizeof(T);
+    }
+
+    std::ostream& out_;
+    uint64_t offset_;
+    std::vector<uint64_t> offsets_;
+
+public:
+    static constexpr uint64_t kMagic = 0x3144524345525a4dULL; // "MZRECRD1" in little-endian bytes
+};
+
+class RecordFileReader {
+public:
+    bool open(const std::string& file_name)
+    {
+        if (file_.is_open()) { file_.close(); }
+        try {
+            file_.open(file_name);
+        } catch (const std::ios_base::failure&) { // boost throws instead of leaving the file closed, e.g., for a missing or unreadable file
+            return false;
+        }
+        if (!file_.is_open()) { return false; }
+        if (!readIndex()) {
+            file_.close();
+            return false;
+        }
+        return true;
+    }
+
+    // the returned pointer stays valid until the reader is closed or destroyed
+    std::pair<const char*, size_t> getRecord(size_t index) const
+    {
+        assert(index < num_records_);
+        const uint64_t begin = getOffset(index);
+        const uint64_t end = (index + 1 < num_records_ ? getOffset(index + 1) : index_offset_);
+        return {file_.data() + begin, end - begin};
+    }
+
+    inline void close() { file_.close(); }
+    inline size_t getNumRecords() const { return num_records_; }
+
+    static bool isRecordFile(const std::string& file_name)
+    {
+        std::ifstream fin(file_name, std::ifstream::binary);
+        uint64_t magic = 0;
+        return fin.read(reinterpret_cast<char*>(&magic), sizeof(uint64_t)) && magic == RecordFileWriter::kMagic;
+    }
+
+private:
+    // checks the magics and that the offsets are non-decreasing and within the records, so that getRecord never reads out of the file
+    bool readIndex()
+    {
+        num_records_ = 0;
+        index_offset_ = 0;
+        if (file_.size() < 4 * sizeof(uint64_t)) { return false; }
+
+        const char* data = file_.data();
+        const char* footer = data + file_.size() - 3 * sizeof(uint64_t);
+        uint64_t head_magic, num_records, index_offset, tail_magic;
+        std::memcpy(&head_magic, data, sizeof(uint64_t));
+        std::memcpy(&num_records, footer, sizeof(uint64_t));
+        std::memcpy(&index_offset, footer + sizeof(uint64_t), sizeof(uint64_t));
+        std::memcpy(&tail_magic, footer + 2 * sizeof(uint64_t), sizeof(uint64_t));
+        if (head_magic != RecordFileWriter::kMagic || tail_magic != RecordFileWriter::kMagic) { return false; }
+        const uint64_t index_end = footer - data;
+        if (num_records > index_end / sizeof(uint64_t) || index_offset != index_end - num_records * sizeof(uint64_t)) { return false; }
+
+        uint64_t previous_offset = sizeof(uint64_t);
+        for (size_t index = 0; index < num_records; ++index) {
+            uint64_t offset;
+            std::memcpy(&offset, data + index_offset + index * sizeof(uint64_t), sizeof(uint64_t));
+            if (offset < previous_offset || offset > index_offset) { return false; }
+            previous_offset = offset;
+        }
+
+        num_records_ = num_records;
+        index_offset_ = index_offset;
+        return true;
+    }
+
+    inline uint64_t getOffset(size_t index) const
+    {
+        uint64_t offset;
+        std::memcpy(&offset, file_.data() + index_offset_ + index * sizeof(uint64_t), sizeof(uint64_t));
+        return offset;
+    }
+
+    boost::iostreams::mapped_file_source file_;
+    size_t num_records_ = 0;
+    uint64_t index_offset_ = 0;
+};
+
+} // namespace minizero::utils
@@ -1,8 +1,15 @@
 #pragma once
 
 #include <cassert>
+#include <map>
+#include <mutex>
 #include <string>
+#include <utility>
 #include <vector>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define ROTATION_X86
+#endif
 
 namespace minizero::utils {
 
@@ -48,7 +55,7 @@ inline Rotation getRotationFromString(const std::string rotation_str)
     return Rotation::kRotateSize;
 }
 
-inline int getPositionByRotating(Rotation rotation, int original_pos, int board_size)
+inline int calculatePositionByRotating(Rotation rotation, int original_pos, int board_size)
 {
     assert(original_pos >= 0 && original_pos <= board_size * board_size);
     if (original_pos == board_size * board_size) { return original_pos; }
@@ -92,4 +99,77 @@ inline int getPositionByRotating(Rotation rotation, int original_pos, int board_
     return new_pos;
 }
 
+const int kMaxRotationBoardSize = 32;
+
+inline std::vector<int> calculateRotationTable(Rotation rotation, int board_size)
+{
+    std::vector<int> table(board_size * board_size + 1);
+    for (int pos = 0; pos <= board_size * board_size; ++pos) { table[pos] = calculatePositionByRotating(rotation, pos, board_size); }
+    return table;
+}
+
+// the table of a rotation maps every position of the board, including the pass position board_size * board_size, to its rotated position
+// the tables of a board size are calculated on first use and shared by all threads; board sizes up to kMaxRotationBoardSize are looked up
+// without locking, larger ones are kept in a map that grows on demand
+inline const int* getRotationTable(Rotation rotation, int board_size)
+{
+    assert(board_size > 0 && rotation != Rotation::kRotateSize);
+    if (board_size > kMaxRotationBoardSize) {
+        static std::mutex mutex;
+        static std::map<std::pair<int, int>, std::vector<int>> large_tables;
+        std::lock_guard<std::mutex> lock(mutex);
+        std::vector<int>& table = large_tables[{board_size, static_cast<int>(rotation)}];
+        if (table.empty()) { table = calculateRotationTable(rotation, board_size); }
+        return table.data();
+    }
+
+    static std::once_flag once_flags[kMaxRotationBoardSize + 1];
+    static std::vector<int> tables[kMaxRotationBoardSize + 1][static_cast<int>(Rotation::kRotateSize)];
+    std::call_once(once_flags[board_size], [board_size]() {
+        for (int r = 0; r < static_cast<int>(Rotation::kRotateSize); ++r) { tables[board_size][r] = calculateRotationTable(static_cast<Rotation>(r), board_size); }
+    });
+    return tables[board_size][static_cast<int>(rotation)].data();
+}
+
+inline int getPositionByRotating(Rotation rotation, int original_pos, int board_size)
+{
+    assert(original_pos >= 0 && original_pos <= board_size * board_size);
+    if (board_size > kMaxRotationBoardSize) { return calculatePositionByRotating(rotation, original_pos, board_size); }
+    return getRotationTable(rotation, board_size)[original_pos];
+}
+
+#ifdef ROTATION_X86
+__attribute__((target("avx2"))) inline void permutePlanesAVX2(const float* planes, int num_planes, int plane_size, const int* positions, float* permuted_planes)
+{
+    for (int plane = 0; plane < num_planes; ++plane) {
+        const float* src = planes + plane * plane_size;
+        float* dst = permuted_planes + plane * plane_size;
+        int pos = 0;
+        for (; pos + 8 <= plane_size; pos += 8) {
+            const __m256i index = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(positions + pos));
+            _mm256_storeu_ps(dst + pos, _mm256_i32gather_ps(src, index, 4));
+        }
+        for (; pos < plane_size; ++pos) { dst[pos] = src[positions[pos]]; }
+    }
+}
+#endif
+
+// permuted_planes[plane][pos] = planes[plane][positions[pos]] for each of the num_planes planes, e.g., rotating features by the table of the reversed rotation
+// planes and permuted_planes must not overlap
+inline void permutePlanes(const float* planes, int num_planes, int plane_size, const int* positions, float* permuted_planes)
+{
+#ifdef ROTATION_X86
+    static const bool use_avx2 = __builtin_cpu_supports("avx2");
+    if (use_avx2) {
+        permutePlanesAVX2(planes, num_planes, plane_size, positions, permuted_planes);
+        return;
+    }
+#endif
+    for (int plane = 0; plane < num_planes; ++plane) {
+        const float* src = planes + plane * plane_size;
+        float* dst = permuted_planes + plane * plane_size;
+        for (int pos = 0; pos < plane_size; ++pos) { dst[pos] = src[positions[pos]]; }
+    }
+}
+
 } // namespace minizero::utils
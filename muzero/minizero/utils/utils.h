@@ -5,6 +5,8 @@
 #include <boost/iostreams/filter/gzip.hpp>
 #include <boost/iostreams/filtering_streambuf.hpp>
 #include <cmath>
+#include <cstdint>
+#include <cstring>
 #include <iomanip>
 #include <numeric>
 #include <sstream>
@@ -111,6 +113,35 @@ inline float invertValue(float value)
     return sign_value * (powf((sqrt(1 + 4 * epsilon * (fabs(value) + 1 + epsilon)) - 1) / (2 * epsilon), 2.0f) - 1);
 }
 
+inline uint64_t mixHashKey(uint64_t hash_key)
+{
+    // the splitmix64 finalizer, every input bit affects every output bit
+    hash_key = (hash_key ^ (hash_key >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    hash_key = (hash_key ^ (hash_key >> 27)) * 0x94d049bb133111ebULL;
+    return hash_key ^ (hash_key >> 31);
+}
+
+// hashes the bit patterns of the features two floats at a time, fully mixing every 64-bit chunk into the key;
+// a different seed gives an independent key, e.g., to check a hit of a cache keyed by the default seed
+inline uint64_t hashFeatures(const std::vector<float>& features, uint64_t seed = 0x9e3779b97f4a7c15ULL)
+{
+    uint64_t hash_key = mixHashKey(seed ^ features.size());
+    size_t i = 0;
+    for (; i + 1 < features.size(); i += 2) {
+        uint64_t chunk;
+        std::memcpy(&chunk, &features[i], sizeof(chunk));
+        hash_key = mixHashKey(hash_key ^ chunk) + seed;
+    }
+    if (i < features.size()) {
+        uint32_t bits;
+        std::memcpy(&bits, &features[i], sizeof(bits));
+        hash_key = mixHashKey(hash_key ^ bits) + seed;
+    }
+    return hash_key;
+}
+
+inline uint64_t hashFeaturesCheckKey(const std::vector<float>& features) { return hashFeatures(features, 0xd1b54a32d192ed03ULL); }
+
 template <typename T>
 float stddev(const std::vector<T>& input)
 {
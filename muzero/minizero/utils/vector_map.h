@@ -2,7 +2,7 @@
 
 #include <algorithm>
 #include <cassert>
-#include <deque>
+#include <stdexcept>
 #include <utility>
 #include <vector>
 
@@ -103,7 +103,7 @@ public:
     auto end() const { return info_.end(); }
 
 private:
-    std::deque<Item> info_;
+    std::vector<Item> info_;
 };
 
 } // namespace minizero::utils
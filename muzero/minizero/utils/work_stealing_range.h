@@ -0,0 +1,93 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <cstdint>
+#include <memory>
+
+namespace minizero::utils {
+
+// hands out the indices [begin, end) to a fixed set of threads in chunks, without any global lock
+// the range is split evenly into one slot per thread, each thread takes chunks from the front of its own slot,
+// and a thread whose slot runs empty steals the back half of another slot
+// assign() must not run concurrently with next(), e.g., it is called before the slave threads start
+class WorkStealingRange {
+public:
+    WorkStealingRange()
+        : num_slots_(0), chunk_size_(1) {}
+
+    void reset(int num_slots)
+    {
+        assert(num_slots > 0);
+        num_slots_ = num_slots;
+        slots_ = std::make_unique<Slot[]>(num_slots_);
+        assign(0, 0);
+    }
+
+    void assign(int begin, int end, int chunk_size = 1)
+    {
+        assert(num_slots_ > 0 && 0 <= begin && begin <= end && chunk_size > 0);
+        chunk_size_ = chunk_size;
+        for (int slot = 0; slot < num_slots_; ++slot) {
+            const int64_t size = end - begin;
+            const int slot_begin = begin + size * slot / num_slots_;
+            const int slot_end = begin + size * (slot + 1) / num_slots_;
+            slots_[slot].range_.store(pack(slot_begin, slot_end), std::memory_order_relaxed);
+        }
+    }
+
+    // returns false once no slot has any index left; indices still being stolen by another thread are handled by that thread
+    bool next(int thread_id, int& begin, int& end)
+    {
+        assert(num_slots_ > 0);
+        std::atomic<uint64_t>& own = slots_[thread_id % num_slots_].range_;
+        uint64_t range = own.load(std::memory_order_acquire);
+        while (getBegin(range) < getEnd(range)) {
+            const int chunk_end = std::min(getEnd(range), getBegin(range) + chunk_size_);
+            if (own.compare_exchange_weak(range, pack(chunk_end, getEnd(range)), std::memory_order_acq_rel, std::memory_order_acquire)) {
+                begin = getBegin(range);
+                end = chunk_end;
+                return true;
+            }
+        }
+
+        for (int i = 1; i < num_slots_; ++i) {
+            std::atomic<uint64_t>& victim = slots_[(thread_id + i) % num_slots_].range_;
+            range = victim.load(std::memory_order_acquire);
+            while (getBegin(range) < getEnd(range)) {
+                // the victim keeps [begin, middle), the thief takes [middle, end)
+                const int middle = getBegin(range) + (getEnd(range) - getBegin(range)) / 2;
+                if (victim.compare_exchange_weak(range, pack(getBegin(range), middle), std::memory_order_acq_rel, std::memory_order_acquire)) {
+                    // the own slot is empty, so no other thread can be modifying it; the stolen indices never appeared in it before,
+                    // which rules out a thief holding a stale copy of the new value
+                    const int chunk_end = std::min(getEnd(range), middle + chunk_size_);
+                    own.store(pack(chunk_end, getEnd(range)), std::memory_order_release);
+                    begin = middle;
+                    end = chunk_end;
+                    return true;
+                }
+            }
+        }
+        return false;
+    }
+
+    inline int getNumSlots() const { return num_slots_; }
+
+private:
+    // one slot per cache line, so that threads popping from their own slots do not share lines
+    class alignas(64) Slot {
+    public:
+        std::atomic<uint64_t> range_;
+    };
+
+    static inline uint64_t pack(int begin, int end) { return (static_cast<uint64_t>(static_cast<uint32_t>(begin)) << 32) | static_cast<uint32_t>(end); }
+    static inline int getBegin(uint64_t range) { return static_cast<int>(range >> 32); }
+    static inline int getEnd(uint64_t range) { return static_cast<int>(range & 0xFFFFFFFFULL); }
+
+    int num_slots_;
+    int chunk_size_;
+    std::unique_ptr<Slot[]> slots_;
+};
+
+} // namespace minizero::utils
@@ -186,6 +186,7 @@ void ZeroServer::selfPlay()
     if (config::zero_num_games_per_iteration > 0) { shared_data_.logger_.getSelfPlayFileStream().open(self_play_file_name.c_str(), std::ios::out); }
     shared_data_.logger_.addTrainingLog("[Iteration] =====" + std::to_string(iteration_) + "=====");
     shared_data_.logger_.addTrainingLog("[SelfPlay] Start " + std::to_string(shared_data_.getModelIetration()));
+    if (config::zero_num_games_per_iteration > 0 && config::learner_tail_interval > 0) { broadcastTailJob(); }
 
     std::vector<int> game_lengths;
     std::vector<float> game_returns;
@@ -249,6 +250,16 @@ void ZeroServer::broadcastSelfPlayJob()
     }
 }
 
+void ZeroServer::broadcastTailJob()
+{
+    // the op worker loads the games of this iteration while they are being played, since each game is flushed to the file once received
+    boost::lock_guard<boost::mutex> lock(worker_mutex_);
+    for (auto& worker : connections_) {
+        if (worker->getType() != "op") { continue; }
+        worker->write("tail_data " + std::to_string(iteration_));
+    }
+}
+
 void ZeroServer::optimization()
 {
     shared_data_.logger_.addTrainingLog("[Optimization] Start.");
@@ -106,6 +106,7 @@ protected:
     virtual void initialize();
     virtual void selfPlay();
     virtual void broadcastSelfPlayJob();
+    virtual void broadcastTailJob();
     virtual void optimization();
     virtual std::string getUpdatedConfig();
     void syncConfig();